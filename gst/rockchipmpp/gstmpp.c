@@ -23,8 +23,10 @@
 #endif
 #include <string.h>
 #include "gstmpph264enc.h"
+#include "gstmpph265enc.h"
 #include "gstmppjpegenc.h"
 #include "gstmppvideodec.h"
+#include "gstmppjpegdec.h"
 
 GST_DEBUG_CATEGORY (mpp_debug);
 #define GST_CAT_DEFAULT mpp_debug
@@ -37,11 +39,24 @@ plugin_init (GstPlugin * plugin)
           gst_mpp_video_dec_get_type ()))
     return FALSE;
 
-  if (!gst_element_register (plugin, "mpph264enc", GST_RANK_PRIMARY + 1,
+  if (!mpp_check_support_format (MPP_CTX_DEC, MPP_VIDEO_CodingMJPEG)
+      && !gst_element_register (plugin, "mppjpegdec", GST_RANK_PRIMARY + 1,
+          gst_mpp_jpeg_dec_get_type ()))
+    return FALSE;
+
+  /* Only the encoders this MPP build has */
+  if (!mpp_check_support_format (MPP_CTX_ENC, MPP_VIDEO_CodingAVC)
+      && !gst_element_register (plugin, "mpph264enc", GST_RANK_PRIMARY + 1,
           gst_mpp_h264_enc_get_type ()))
     return FALSE;
 
-  if (!gst_element_register (plugin, "mppjpegenc", GST_RANK_PRIMARY,
+  if (!mpp_check_support_format (MPP_CTX_ENC, MPP_VIDEO_CodingHEVC)
+      && !gst_element_register (plugin, "mpph265enc", GST_RANK_PRIMARY + 1,
+          gst_mpp_h265_enc_get_type ()))
+    return FALSE;
+
+  if (!mpp_check_support_format (MPP_CTX_ENC, MPP_VIDEO_CodingMJPEG)
+      && !gst_element_register (plugin, "mppjpegenc", GST_RANK_PRIMARY,
           gst_mpp_jpeg_enc_get_type ()))
     return FALSE;
 
@@ -192,8 +192,16 @@ done:
 static void
 gst_mpp_allocator_free (GstAllocator * gallocator, GstMemory * gmem)
 {
+  GstMppAllocator *allocator = (GstMppAllocator *) gallocator;
   GstMppMemory *mem = (GstMppMemory *) gmem;
 
+  /* The allocator would free it again when it is stopped */
+  GST_OBJECT_LOCK (allocator);
+  if (gmem->parent == NULL && mem->index >= 0 && mem->index < VIDEO_MAX_FRAME
+      && allocator->mems[mem->index] == mem)
+    allocator->mems[mem->index] = NULL;
+  GST_OBJECT_UNLOCK (allocator);
+
   _mppmem_free (mem);
 }
 
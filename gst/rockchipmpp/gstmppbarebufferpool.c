@@ -77,7 +77,9 @@ gst_mpp_bare_buffer_pool_start (GstBufferPool * bpool)
           &max_buffers))
     goto wrong_config;
 
-  count = gst_mpp_allocator_start (pool->vallocator, size, min_buffers);
+  GST_VIDEO_INFO_SIZE (&pool->obj->info) = size;
+  count = gst_mpp_allocator_start (pool->vallocator, min_buffers,
+      pool->obj->mode);
   if (count < min_buffers)
     goto no_buffers;
 
@@ -123,25 +125,32 @@ gst_mpp_bare_buffer_pool_stop (GstBufferPool * bpool)
 {
   GstMppBareBufferPool *pool = GST_MPP_BARE_BUFFER_POOL (bpool);
   GstBufferPoolClass *pclass = GST_BUFFER_POOL_CLASS (parent_class);
+  GstBuffer *buffer;
   gboolean ret;
-  guint n;
 
   GST_DEBUG_OBJECT (pool, "stop pool %p", pool);
 
   /* free the remaining buffers */
-  for (n = 0; n < VIDEO_MAX_FRAME; n++) {
-    if (pool->buffers[n]) {
-      GstBuffer *buffer = pool->buffers[n];
+  GST_OBJECT_LOCK (pool);
+  while ((buffer = g_queue_pop_head (&pool->free_queue))) {
+    GstMppMemory *mem = NULL;
 
-      pool->buffers[n] = NULL;
-      pclass->release_buffer (bpool, buffer);
+    if (gst_mpp_bare_is_buffer_valid (buffer, &mem))
+      pool->buffers[mpp_buffer_get_index (mem->mpp_buf)] = NULL;
+    g_atomic_int_add (&pool->num_queued, -1);
 
-      g_atomic_int_add (&pool->num_queued, -1);
-    }
+    GST_OBJECT_UNLOCK (pool);
+    pclass->release_buffer (bpool, buffer);
+    GST_OBJECT_LOCK (pool);
   }
+  GST_OBJECT_UNLOCK (pool);
+
   /* free the buffers in the queue */
   ret = pclass->stop (bpool);
 
+  if (ret && pool->vallocator)
+    ret = (gst_mpp_allocator_stop (pool->vallocator) == 0);
+
   return ret;
 }
 
@@ -178,22 +187,28 @@ gst_mpp_bare_buffer_pool_release_buffer (GstBufferPool * bpool,
     GstBuffer * buffer)
 {
   GstMppBareBufferPool *pool = GST_MPP_BARE_BUFFER_POOL (bpool);
+  GstBufferPoolClass *pclass = GST_BUFFER_POOL_CLASS (parent_class);
   GstMppMemory *mem = NULL;
   gint index = -1;
 
   if (!gst_mpp_bare_is_buffer_valid (buffer, &mem))
-    GST_ERROR_OBJECT (pool, "can't release an invalid buffer");
+    goto invalid_buffer;
 
   index = mpp_buffer_get_index (mem->mpp_buf);
+  if (index < 0 || index >= VIDEO_MAX_FRAME)
+    goto invalid_buffer;
 
-  if (pool->buffers[index] != NULL) {
+  GST_OBJECT_LOCK (pool);
+  if (pool->buffers[index] != NULL)
     goto already_queued;
-  } else {
-    /* Release the internal refcount in mpp */
-    mpp_buffer_put (mem->mpp_buf);
-    pool->buffers[index] = buffer;
-    g_atomic_int_add (&pool->num_queued, 1);
-  }
+
+  /* Release the internal refcount in mpp */
+  mpp_buffer_put (mem->mpp_buf);
+  pool->buffers[index] = buffer;
+  g_queue_push_tail (&pool->free_queue, buffer);
+  g_atomic_int_add (&pool->num_queued, 1);
+  g_cond_signal (&pool->free_cond);
+  GST_OBJECT_UNLOCK (pool);
 
   GST_DEBUG_OBJECT (pool,
       "released buffer %p, index %d, queued %d", buffer, index,
@@ -201,8 +216,16 @@ gst_mpp_bare_buffer_pool_release_buffer (GstBufferPool * bpool,
 
   return;
   /* ERRORS */
+invalid_buffer:
+  {
+    GST_ERROR_OBJECT (pool, "can't release an invalid buffer");
+    GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_TAG_MEMORY);
+    pclass->release_buffer (bpool, buffer);
+    return;
+  }
 already_queued:
   {
+    GST_OBJECT_UNLOCK (pool);
     GST_WARNING_OBJECT (pool, "the buffer was already released");
     return;
   }
@@ -216,20 +239,26 @@ gst_mpp_bare_buffer_pool_acquire_buffer (GstBufferPool * bpool,
   GstBuffer *outbuf = NULL;
   GstMppMemory *mem = NULL;
 
-  for (gint n = 0; pool->count; n++) {
-    if (pool->buffers[n]) {
-      outbuf = pool->buffers[n];
-      if (gst_mpp_bare_is_buffer_valid (outbuf, &mem))
-        mpp_buffer_inc_ref (mem->mpp_buf);
+  GST_OBJECT_LOCK (pool);
+  while (g_queue_is_empty (&pool->free_queue)) {
+    if (pool->flushing)
+      goto flushing;
+
+    if (params && (params->flags & GST_BUFFER_POOL_ACQUIRE_FLAG_DONTWAIT))
+      goto no_buffer;
 
-      pool->buffers[n] = NULL;
-      g_atomic_int_add (&pool->num_queued, -1);
-      break;
-    }
+    /* Wait for downstream to give us a buffer back */
+    GST_LOG_OBJECT (pool, "waiting for a free buffer");
+    g_cond_wait (&pool->free_cond, GST_OBJECT_GET_LOCK (pool));
+  }
 
+  outbuf = g_queue_pop_head (&pool->free_queue);
+  if (gst_mpp_bare_is_buffer_valid (outbuf, &mem)) {
+    pool->buffers[mpp_buffer_get_index (mem->mpp_buf)] = NULL;
+    mpp_buffer_inc_ref (mem->mpp_buf);
   }
-  if (!outbuf)
-    goto no_buffer;
+  g_atomic_int_add (&pool->num_queued, -1);
+  GST_OBJECT_UNLOCK (pool);
 
   GST_DEBUG_OBJECT (pool,
       "acquired buffer %p, queued %d", outbuf,
@@ -240,14 +269,47 @@ gst_mpp_bare_buffer_pool_acquire_buffer (GstBufferPool * bpool,
   return GST_FLOW_OK;
 
   /* ERRORS */
+flushing:
+  {
+    GST_OBJECT_UNLOCK (pool);
+    *buffer = NULL;
+    GST_DEBUG_OBJECT (pool, "pool is flushing");
+    return GST_FLOW_FLUSHING;
+  }
 no_buffer:
   {
+    GST_OBJECT_UNLOCK (pool);
     *buffer = NULL;
-    GST_ERROR_OBJECT (pool, "No free buffer found in the pool");
-    return GST_FLOW_ERROR;
+    GST_DEBUG_OBJECT (pool, "no free buffer found in the pool");
+    return GST_FLOW_EOS;
   }
 }
 
+static void
+gst_mpp_bare_buffer_pool_flush_start (GstBufferPool * bpool)
+{
+  GstMppBareBufferPool *pool = GST_MPP_BARE_BUFFER_POOL (bpool);
+
+  GST_DEBUG_OBJECT (pool, "start flushing");
+
+  GST_OBJECT_LOCK (pool);
+  pool->flushing = TRUE;
+  g_cond_broadcast (&pool->free_cond);
+  GST_OBJECT_UNLOCK (pool);
+}
+
+static void
+gst_mpp_bare_buffer_pool_flush_stop (GstBufferPool * bpool)
+{
+  GstMppBareBufferPool *pool = GST_MPP_BARE_BUFFER_POOL (bpool);
+
+  GST_DEBUG_OBJECT (pool, "stop flushing");
+
+  GST_OBJECT_LOCK (pool);
+  pool->flushing = FALSE;
+  GST_OBJECT_UNLOCK (pool);
+}
+
 static gboolean
 gst_mpp_bare_buffer_pool_set_config (GstBufferPool * bpool,
     GstStructure * config)
@@ -313,6 +375,9 @@ gst_mpp_bare_buffer_pool_finalize (GObject * object)
 {
   GstMppBareBufferPool *pool = GST_MPP_BARE_BUFFER_POOL (object);
 
+  g_cond_clear (&pool->free_cond);
+  if (pool->obj)
+    gst_mpp_object_destroy (pool->obj);
   gst_object_unref (pool->dec);
 
   G_OBJECT_CLASS (parent_class)->finalize (object);
@@ -322,7 +387,11 @@ static void
 gst_mpp_bare_buffer_pool_init (GstMppBareBufferPool * pool)
 {
   pool->dec = NULL;
+  pool->obj = NULL;
   pool->num_queued = 0;
+  pool->flushing = FALSE;
+  g_queue_init (&pool->free_queue);
+  g_cond_init (&pool->free_cond);
 }
 
 static void
@@ -340,7 +409,8 @@ gst_mpp_bare_buffer_pool_class_init (GstMppBareBufferPoolClass * klass)
   bufferpool_class->alloc_buffer = gst_mpp_bare_buffer_pool_alloc_buffer;
   bufferpool_class->acquire_buffer = gst_mpp_bare_buffer_pool_acquire_buffer;
   bufferpool_class->release_buffer = gst_mpp_bare_buffer_pool_release_buffer;
-
+  bufferpool_class->flush_start = gst_mpp_bare_buffer_pool_flush_start;
+  bufferpool_class->flush_stop = gst_mpp_bare_buffer_pool_flush_stop;
 
   GST_DEBUG_CATEGORY_INIT (mppbarebufferpool_debug, "mppbarebufferpool", 0,
       "mpp bare bufferpool");
@@ -367,7 +437,11 @@ gst_mpp_bare_buffer_pool_new (GstMppJpegDec * dec, GstCaps * caps)
   /* take a reference on decoder to be sure that it will be released
    * after the pool */
   pool->dec = gst_object_ref (dec);
-  pool->vallocator = gst_mpp_allocator_new (GST_OBJECT (pool));
+  pool->obj = gst_mpp_object_new (GST_ELEMENT (dec), FALSE);
+  pool->obj->type = GST_MPP_DEC_OUTPUT;
+  pool->obj->mode = GST_MPP_IO_ION;
+  pool->obj->info = dec->info;
+  pool->vallocator = gst_mpp_allocator_new (GST_OBJECT (pool), pool->obj);
   if (!pool->vallocator)
     goto allocator_failed;
 
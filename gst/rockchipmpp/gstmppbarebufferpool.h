@@ -23,6 +23,7 @@
 #define __GST_MPP_BARE_BUFFER_POOL_H__
 
 #include <gst/gst.h>
+#include <gst/allocators/gstdmabuf.h>
 
 #include "gstmppallocator.h"
 #include "gstmppjpegdec.h"
@@ -39,13 +40,21 @@ struct _GstMppBareBufferPool
 {
   GstBufferPool parent;
   GstMppJpegDec *dec;
+  /* only describes the buffers to the allocator, it has no mpp context */
+  GstMppObject *obj;
 
   guint num_queued;
   guint count;
 
   guint size;
+  /* buffers which are in the free list, indexed by the mpp buffer index */
   GstBuffer *buffers[VIDEO_MAX_FRAME];
 
+  /* free list, protected by the object lock */
+  GQueue free_queue;
+  GCond free_cond;
+  gboolean flushing;
+
   GstMppAllocator *vallocator;
   GstAllocator *allocator;
   GstAllocationParams params;
@@ -161,6 +161,9 @@ gst_mpp_buffer_pool_start (GstBufferPool * bpool)
 
   if (max_buffers != 0 && max_buffers < min_buffers)
     max_buffers = min_buffers;
+  /* The allocator can't allocate more buffers once started */
+  if (obj->type == GST_MPP_ENC_INPUT)
+    max_buffers = min_buffers;
 
   gst_buffer_pool_config_set_params (config, caps, size, min_buffers,
       max_buffers);
@@ -495,6 +498,11 @@ gst_mpp_buffer_pool_acquire_buffer (GstBufferPool * bpool,
     case GST_MPP_DEC_OUTPUT:
       ret = gst_mpp_buffer_pool_dqbuf (pool, buffer);
       break;
+    case GST_MPP_ENC_INPUT:
+      /* The encoder only reads the buffers, they are never queued */
+      ret = GST_BUFFER_POOL_CLASS (parent_class)->acquire_buffer (bpool,
+          buffer, params);
+      break;
     default:
       ret = GST_FLOW_ERROR;
       g_assert_not_reached ();
@@ -531,6 +539,9 @@ gst_mpp_buffer_pool_release_buffer (GstBufferPool * bpool, GstBuffer * buffer)
       }
     }
       break;
+    case GST_MPP_ENC_INPUT:
+      pclass->release_buffer (bpool, buffer);
+      break;
     default:
       g_assert_not_reached ();
       break;
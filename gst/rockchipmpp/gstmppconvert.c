@@ -0,0 +1,269 @@
+/*
+ * Copyright 2017 Rockchip Electronics Co., Ltd
+ *     Author: Randy Li <randy.li@rock-chips.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "gstmppconvert.h"
+
+/*
+ * Copy paths of the encoder converting into its NV12 input buffers. The
+ * NEON loops handle the bulk of each line and the scalar code the rest,
+ * or everything on other architectures, with the same rounding.
+ */
+
+/* BT.601 limited range */
+#define RGB_TO_Y(r, g, b) (((66 * (r) + 129 * (g) + 25 * (b) + 128) >> 8) + 16)
+#define RGB_TO_U(r, g, b) (((112 * (b) - 38 * (r) - 74 * (g) + 128) >> 8) + 128)
+#define RGB_TO_V(r, g, b) (((112 * (r) - 94 * (g) - 18 * (b) + 128) >> 8) + 128)
+
+/* Two lines of YUY2, the chroma of both is averaged */
+static void
+gst_mpp_convert_yuy2_lines (const guint8 * src0, const guint8 * src1,
+    guint8 * y0, guint8 * y1, guint8 * uv, gint width)
+{
+  gint x = 0;
+
+#ifdef __ARM_NEON
+  for (; x + 32 <= width; x += 32) {
+    uint8x16x4_t a = vld4q_u8 (src0 + x * 2);
+    uint8x16x4_t b = vld4q_u8 (src1 + x * 2);
+    uint8x16x2_t p;
+
+    p.val[0] = a.val[0];
+    p.val[1] = a.val[2];
+    vst2q_u8 (y0 + x, p);
+    p.val[0] = b.val[0];
+    p.val[1] = b.val[2];
+    vst2q_u8 (y1 + x, p);
+
+    p.val[0] = vrhaddq_u8 (a.val[1], b.val[1]);
+    p.val[1] = vrhaddq_u8 (a.val[3], b.val[3]);
+    vst2q_u8 (uv + x, p);
+  }
+#endif
+
+  for (; x < width; x += 2) {
+    y0[x] = src0[x * 2];
+    y1[x] = src1[x * 2];
+    if (x + 1 < width) {
+      y0[x + 1] = src0[x * 2 + 2];
+      y1[x + 1] = src1[x * 2 + 2];
+    }
+    uv[x] = (src0[x * 2 + 1] + src1[x * 2 + 1] + 1) >> 1;
+    uv[x + 1] = (src0[x * 2 + 3] + src1[x * 2 + 3] + 1) >> 1;
+  }
+}
+
+/* Interleave a line of each I420 chroma plane */
+static void
+gst_mpp_convert_i420_line (const guint8 * u, const guint8 * v, guint8 * uv,
+    gint width)
+{
+  gint x = 0;
+
+#ifdef __ARM_NEON
+  for (; x + 16 <= width; x += 16) {
+    uint8x16x2_t p;
+
+    p.val[0] = vld1q_u8 (u + x);
+    p.val[1] = vld1q_u8 (v + x);
+    vst2q_u8 (uv + x * 2, p);
+  }
+#endif
+
+  for (; x < width; x++) {
+    uv[x * 2] = u[x];
+    uv[x * 2 + 1] = v[x];
+  }
+}
+
+#ifdef __ARM_NEON
+static inline uint8x16_t
+gst_mpp_convert_bgrx_to_y (uint8x16x4_t p)
+{
+  uint16x8_t lo, hi;
+
+  lo = vmull_u8 (vget_low_u8 (p.val[2]), vdup_n_u8 (66));
+  lo = vmlal_u8 (lo, vget_low_u8 (p.val[1]), vdup_n_u8 (129));
+  lo = vmlal_u8 (lo, vget_low_u8 (p.val[0]), vdup_n_u8 (25));
+  hi = vmull_u8 (vget_high_u8 (p.val[2]), vdup_n_u8 (66));
+  hi = vmlal_u8 (hi, vget_high_u8 (p.val[1]), vdup_n_u8 (129));
+  hi = vmlal_u8 (hi, vget_high_u8 (p.val[0]), vdup_n_u8 (25));
+
+  return vaddq_u8 (vcombine_u8 (vrshrn_n_u16 (lo, 8), vrshrn_n_u16 (hi, 8)),
+      vdupq_n_u8 (16));
+}
+
+/* Average of the 2x2 blocks of a component */
+static inline int16x8_t
+gst_mpp_convert_average (uint8x16_t a, uint8x16_t b)
+{
+  return vreinterpretq_s16_u16 (vrshrq_n_u16 (vaddq_u16 (vpaddlq_u8 (a),
+              vpaddlq_u8 (b)), 2));
+}
+#endif
+
+/* Two lines of BGRx, the chroma comes from the average of 2x2 blocks */
+static void
+gst_mpp_convert_bgrx_lines (const guint8 * src0, const guint8 * src1,
+    guint8 * y0, guint8 * y1, guint8 * uv, gint width)
+{
+  gint x = 0;
+
+#ifdef __ARM_NEON
+  for (; x + 16 <= width; x += 16) {
+    uint8x16x4_t a = vld4q_u8 (src0 + x * 4);
+    uint8x16x4_t b = vld4q_u8 (src1 + x * 4);
+    int16x8_t r, g, bl, u, v;
+    uint8x8x2_t p;
+
+    vst1q_u8 (y0 + x, gst_mpp_convert_bgrx_to_y (a));
+    vst1q_u8 (y1 + x, gst_mpp_convert_bgrx_to_y (b));
+
+    bl = gst_mpp_convert_average (a.val[0], b.val[0]);
+    g = gst_mpp_convert_average (a.val[1], b.val[1]);
+    r = gst_mpp_convert_average (a.val[2], b.val[2]);
+
+    u = vmulq_n_s16 (bl, 112);
+    u = vmlsq_n_s16 (u, r, 38);
+    u = vmlsq_n_s16 (u, g, 74);
+    u = vshrq_n_s16 (vaddq_s16 (u, vdupq_n_s16 (128)), 8);
+    v = vmulq_n_s16 (r, 112);
+    v = vmlsq_n_s16 (v, g, 94);
+    v = vmlsq_n_s16 (v, bl, 18);
+    v = vshrq_n_s16 (vaddq_s16 (v, vdupq_n_s16 (128)), 8);
+
+    p.val[0] = vqmovun_s16 (vaddq_s16 (u, vdupq_n_s16 (128)));
+    p.val[1] = vqmovun_s16 (vaddq_s16 (v, vdupq_n_s16 (128)));
+    vst2_u8 (uv + x, p);
+  }
+#endif
+
+  for (; x < width; x += 2) {
+    const guint8 *p0 = src0 + x * 4, *p1 = src1 + x * 4;
+    gint r, g, b;
+
+    y0[x] = RGB_TO_Y (p0[2], p0[1], p0[0]);
+    y1[x] = RGB_TO_Y (p1[2], p1[1], p1[0]);
+    if (x + 1 < width) {
+      y0[x + 1] = RGB_TO_Y (p0[6], p0[5], p0[4]);
+      y1[x + 1] = RGB_TO_Y (p1[6], p1[5], p1[4]);
+      b = (p0[0] + p0[4] + p1[0] + p1[4] + 2) >> 2;
+      g = (p0[1] + p0[5] + p1[1] + p1[5] + 2) >> 2;
+      r = (p0[2] + p0[6] + p1[2] + p1[6] + 2) >> 2;
+    } else {
+      b = (p0[0] + p1[0] + 1) >> 1;
+      g = (p0[1] + p1[1] + 1) >> 1;
+      r = (p0[2] + p1[2] + 1) >> 1;
+    }
+    uv[x] = CLAMP (RGB_TO_U (r, g, b), 0, 255);
+    uv[x + 1] = CLAMP (RGB_TO_V (r, g, b), 0, 255);
+  }
+}
+
+static void
+gst_mpp_convert_yuy2_to_nv12 (GstVideoFrame * src, guint8 * dst,
+    gint stride, gint ver_stride)
+{
+  gint width = GST_VIDEO_FRAME_WIDTH (src);
+  gint height = GST_VIDEO_FRAME_HEIGHT (src);
+  gint src_stride = GST_VIDEO_FRAME_PLANE_STRIDE (src, 0);
+  const guint8 *s = GST_VIDEO_FRAME_PLANE_DATA (src, 0);
+  guint8 *uv = dst + stride * ver_stride;
+  gint i;
+
+  for (i = 0; i < height; i += 2) {
+    /* The last line of an odd height is its own pair */
+    gint next = i + 1 < height ? 1 : 0;
+
+    gst_mpp_convert_yuy2_lines (s + i * src_stride,
+        s + (i + next) * src_stride, dst + i * stride,
+        dst + (i + next) * stride, uv + i / 2 * stride, width);
+  }
+}
+
+static void
+gst_mpp_convert_i420_to_nv12 (GstVideoFrame * src, guint8 * dst,
+    gint stride, gint ver_stride)
+{
+  gint width = GST_VIDEO_FRAME_WIDTH (src);
+  gint height = GST_VIDEO_FRAME_HEIGHT (src);
+  gint cr_width = GST_VIDEO_FRAME_COMP_WIDTH (src, 1);
+  gint cr_height = GST_VIDEO_FRAME_COMP_HEIGHT (src, 1);
+  guint8 *uv = dst + stride * ver_stride;
+  gint i;
+
+  for (i = 0; i < height; i++)
+    memcpy (dst + i * stride, (guint8 *) GST_VIDEO_FRAME_PLANE_DATA (src, 0)
+        + i * GST_VIDEO_FRAME_PLANE_STRIDE (src, 0), width);
+
+  for (i = 0; i < cr_height; i++)
+    gst_mpp_convert_i420_line ((guint8 *) GST_VIDEO_FRAME_PLANE_DATA (src, 1)
+        + i * GST_VIDEO_FRAME_PLANE_STRIDE (src, 1),
+        (guint8 *) GST_VIDEO_FRAME_PLANE_DATA (src, 2)
+        + i * GST_VIDEO_FRAME_PLANE_STRIDE (src, 2), uv + i * stride,
+        cr_width);
+}
+
+static void
+gst_mpp_convert_bgrx_to_nv12 (GstVideoFrame * src, guint8 * dst,
+    gint stride, gint ver_stride)
+{
+  gint width = GST_VIDEO_FRAME_WIDTH (src);
+  gint height = GST_VIDEO_FRAME_HEIGHT (src);
+  gint src_stride = GST_VIDEO_FRAME_PLANE_STRIDE (src, 0);
+  const guint8 *s = GST_VIDEO_FRAME_PLANE_DATA (src, 0);
+  guint8 *uv = dst + stride * ver_stride;
+  gint i;
+
+  for (i = 0; i < height; i += 2) {
+    gint next = i + 1 < height ? 1 : 0;
+
+    gst_mpp_convert_bgrx_lines (s + i * src_stride,
+        s + (i + next) * src_stride, dst + i * stride,
+        dst + (i + next) * stride, uv + i / 2 * stride, width);
+  }
+}
+
+/* The conversion of @format to NV12, NULL when there is none */
+GstMppConvertFunc
+gst_mpp_convert_get_func (GstVideoFormat format)
+{
+  switch (format) {
+    case GST_VIDEO_FORMAT_YUY2:
+      return gst_mpp_convert_yuy2_to_nv12;
+    case GST_VIDEO_FORMAT_I420:
+      return gst_mpp_convert_i420_to_nv12;
+    case GST_VIDEO_FORMAT_BGRx:
+    case GST_VIDEO_FORMAT_BGRA:
+      return gst_mpp_convert_bgrx_to_nv12;
+    default:
+      return NULL;
+  }
+}
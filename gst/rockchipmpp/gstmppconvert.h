@@ -0,0 +1,39 @@
+/*
+ * Copyright 2017 Rockchip Electronics Co., Ltd
+ *     Author: Randy Li <randy.li@rock-chips.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifndef __GST_MPP_CONVERT_H__
+#define __GST_MPP_CONVERT_H__
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+G_BEGIN_DECLS
+
+/* Convert @src to NV12 while copying it, the chroma plane starting after
+ * ver_stride lines of stride bytes */
+typedef void (*GstMppConvertFunc) (GstVideoFrame * src, guint8 * dst,
+    gint stride, gint ver_stride);
+
+GstMppConvertFunc gst_mpp_convert_get_func (GstVideoFormat format);
+
+G_END_DECLS
+
+#endif /* __GST_MPP_CONVERT_H__ */
@@ -0,0 +1,104 @@
+/*
+ * Copyright 2017 Rockchip Electronics Co., Ltd
+ *     Author: Randy Li <randy.li@rock-chips.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "gstmppencmeta.h"
+
+GType
+gst_mpp_enc_stats_meta_api_get_type (void)
+{
+  static volatile GType type = 0;
+  static const gchar *tags[] = { NULL };
+
+  if (g_once_init_enter (&type)) {
+    GType _type = gst_meta_api_type_register (GST_MPP_ENC_STATS_META_API_NAME,
+        tags);
+    g_once_init_leave (&type, _type);
+  }
+  return type;
+}
+
+static gboolean
+gst_mpp_enc_stats_meta_init (GstMeta * meta, gpointer params,
+    GstBuffer * buffer)
+{
+  GstMppEncStatsMeta *emeta = (GstMppEncStatsMeta *) meta;
+
+  emeta->avg_qp = -1;
+  emeta->size = 0;
+  emeta->intra = FALSE;
+  emeta->encode_time = GST_CLOCK_TIME_NONE;
+
+  return TRUE;
+}
+
+/* The statistics describe the whole frame, they follow its copies */
+static gboolean
+gst_mpp_enc_stats_meta_transform (GstBuffer * dest, GstMeta * meta,
+    GstBuffer * buffer, GQuark type, gpointer data)
+{
+  GstMppEncStatsMeta *smeta = (GstMppEncStatsMeta *) meta;
+
+  if (!GST_META_TRANSFORM_IS_COPY (type))
+    return FALSE;
+
+  return gst_buffer_add_mpp_enc_stats_meta (dest, smeta->avg_qp, smeta->size,
+      smeta->intra, smeta->encode_time) != NULL;
+}
+
+const GstMetaInfo *
+gst_mpp_enc_stats_meta_get_info (void)
+{
+  static const GstMetaInfo *meta_info = NULL;
+
+  if (g_once_init_enter ((GstMetaInfo **) & meta_info)) {
+    const GstMetaInfo *mi = gst_meta_register (GST_MPP_ENC_STATS_META_API_TYPE,
+        "GstMppEncStatsMeta", sizeof (GstMppEncStatsMeta),
+        gst_mpp_enc_stats_meta_init, NULL,
+        gst_mpp_enc_stats_meta_transform);
+    g_once_init_leave ((GstMetaInfo **) & meta_info, (GstMetaInfo *) mi);
+  }
+  return meta_info;
+}
+
+GstMppEncStatsMeta *
+gst_buffer_add_mpp_enc_stats_meta (GstBuffer * buffer, gint avg_qp,
+    gsize size, gboolean intra, GstClockTime encode_time)
+{
+  GstMppEncStatsMeta *meta;
+
+  g_return_val_if_fail (GST_IS_BUFFER (buffer), NULL);
+
+  meta = (GstMppEncStatsMeta *) gst_buffer_add_meta (buffer,
+      GST_MPP_ENC_STATS_META_INFO, NULL);
+  if (!meta)
+    return NULL;
+
+  meta->avg_qp = avg_qp;
+  meta->size = size;
+  meta->intra = intra;
+  meta->encode_time = encode_time;
+
+  return meta;
+}
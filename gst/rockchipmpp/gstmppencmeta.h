@@ -0,0 +1,75 @@
+/*
+ * Copyright 2017 Rockchip Electronics Co., Ltd
+ *     Author: Randy Li <randy.li@rock-chips.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifndef __GST_MPP_ENC_META_H__
+#define __GST_MPP_ENC_META_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+#define GST_MPP_ENC_STATS_META_API_NAME "GstMppEncStatsMetaAPI"
+#define GST_MPP_ENC_STATS_META_API_TYPE (gst_mpp_enc_stats_meta_api_get_type ())
+#define GST_MPP_ENC_STATS_META_INFO (gst_mpp_enc_stats_meta_get_info ())
+
+typedef struct _GstMppEncStatsMeta GstMppEncStatsMeta;
+
+/* How the encoder produced a frame. With alignment=nal only the last NAL
+ * of the frame carries it, its size covering all of them. */
+struct _GstMppEncStatsMeta
+{
+  GstMeta meta;
+
+  /* Average QP of the frame, -1 when MPP doesn't report it */
+  gint avg_qp;
+  /* Encoded size, headers included */
+  gsize size;
+  gboolean intra;
+  /* Wall-clock time from the frame entering MPP, or the previous frame
+   * leaving it when the hardware was still busy, to its packet being
+   * dequeued. An approximation of the hardware time which includes the
+   * queueing in MPP and the latency of the output thread. */
+  GstClockTime encode_time;
+};
+
+/* For applications, which don't link with the plugin: the API is looked up
+ * by name, it gets registered along with the first meta */
+static inline GstMppEncStatsMeta *
+gst_buffer_get_mpp_enc_stats_meta (GstBuffer * buffer)
+{
+  GType api = g_type_from_name (GST_MPP_ENC_STATS_META_API_NAME);
+
+  if (!api)
+    return NULL;
+
+  return (GstMppEncStatsMeta *) gst_buffer_get_meta (buffer, api);
+}
+
+/* Only available inside of the plugin */
+GType gst_mpp_enc_stats_meta_api_get_type (void);
+const GstMetaInfo *gst_mpp_enc_stats_meta_get_info (void);
+
+GstMppEncStatsMeta *gst_buffer_add_mpp_enc_stats_meta (GstBuffer * buffer,
+    gint avg_qp, gsize size, gboolean intra, GstClockTime encode_time);
+
+G_END_DECLS
+
+#endif /* __GST_MPP_ENC_META_H__ */
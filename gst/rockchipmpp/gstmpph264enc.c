@@ -27,20 +27,61 @@
 
 #define GST_CAT_DEFAULT mppvideoenc_debug
 
+#define DEFAULT_PROP_INTRA_REFRESH 0
+
 #define parent_class gst_mpp_h264_enc_parent_class
 G_DEFINE_TYPE (GstMppH264Enc, gst_mpp_h264_enc, GST_TYPE_MPP_VIDEO_ENC);
 
-static GstStaticPadTemplate gst_mpp_h264_enc_src_template =
-GST_STATIC_PAD_TEMPLATE ("src",
-    GST_PAD_SRC,
-    GST_PAD_ALWAYS,
-    GST_STATIC_CAPS ("video/x-h264, "
-        "width  = (int) [ 32, 1920 ], "
-        "height = (int) [ 32, 1080 ], "
-        "framerate = (fraction) [0/1, 60/1], "
-        "stream-format = (string) { byte-stream }, "
-        "alignment = (string) { au }, " "profile = (string) { high }")
-    );
+enum
+{
+  PROP_0,
+  MPP_ENC_RC_PROPS,
+  PROP_INTRA_REFRESH,
+};
+
+static void
+gst_mpp_h264_enc_set_property (GObject * object,
+    guint prop_id, const GValue * value, GParamSpec * pspec)
+{
+  GstMppH264Enc *self = GST_MPP_H264_ENC (object);
+
+  if (gst_mpp_video_enc_rc_set_property (GST_MPP_VIDEO_ENC (self), prop_id,
+          value, pspec))
+    return;
+
+  switch (prop_id) {
+    case PROP_INTRA_REFRESH:
+      GST_OBJECT_LOCK (self);
+      self->intra_refresh = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_mpp_h264_enc_get_property (GObject * object,
+    guint prop_id, GValue * value, GParamSpec * pspec)
+{
+  GstMppH264Enc *self = GST_MPP_H264_ENC (object);
+
+  if (gst_mpp_video_enc_rc_get_property (GST_MPP_VIDEO_ENC (self), prop_id,
+          value, pspec))
+    return;
+
+  switch (prop_id) {
+    case PROP_INTRA_REFRESH:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint (value, self->intra_refresh);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
 
 static gboolean
 gst_mpp_h264_enc_open (GstVideoEncoder * encoder)
@@ -57,9 +98,117 @@ gst_mpp_h264_enc_open (GstVideoEncoder * encoder)
   return TRUE;
 
 failure:
+  GST_ERROR_OBJECT (self, "failed to create the mpp context");
+  if (self->mpp_ctx) {
+    mpp_destroy (self->mpp_ctx);
+    self->mpp_ctx = NULL;
+    self->mpi = NULL;
+  }
   return FALSE;
 }
 
+/* Push the rate control properties to MPP, fine while encoding */
+static gboolean
+gst_mpp_h264_enc_apply_rc (GstMppH264Enc * self, GstVideoInfo * info)
+{
+  GstMppVideoEnc *mpp_video_enc = GST_MPP_VIDEO_ENC (self);
+  MppEncCodecCfg codec_cfg;
+  GstMppVideoEncQp qp;
+
+  if (!gst_mpp_video_enc_set_rc_cfg (mpp_video_enc, info, &qp))
+    return FALSE;
+
+  memset (&codec_cfg, 0, sizeof (codec_cfg));
+
+  codec_cfg.coding = MPP_VIDEO_CodingAVC;
+  codec_cfg.h264.change = MPP_ENC_H264_CFG_CHANGE_QP_LIMIT;
+  codec_cfg.h264.qp_init = qp.init;
+  codec_cfg.h264.qp_max = qp.max;
+  codec_cfg.h264.qp_min = qp.min;
+  codec_cfg.h264.qp_max_step = qp.max_step;
+
+  if (mpp_video_enc->mpi->control (mpp_video_enc->mpp_ctx,
+          MPP_ENC_SET_CODEC_CFG, &codec_cfg)) {
+    GST_DEBUG_OBJECT (self, "Setting qp limits for rockchip mpp failed");
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Levels from 4.0 on, with their limits in macroblocks per second and per
+ * frame. 4.1 only differs from 4.0 by its bitrate. */
+static const struct
+{
+  gint level;
+  guint64 max_mbps;
+  guint max_fs;
+} gst_mpp_h264_enc_levels[] = {
+  {40, 245760, 8192},
+  {42, 522240, 8704},
+  {50, 589824, 22080},
+  {51, 983040, 36864},
+  {52, 2073600, 36864},
+  {60, 4177920, 139264},
+  {61, 8355840, 139264},
+  {62, 16711680, 139264},
+};
+
+/* Lowest level whose macroblock rate and frame size fit @info, a variable
+ * framerate is taken as 30 fps */
+static gint
+gst_mpp_h264_enc_get_level (GstVideoInfo * info)
+{
+  guint width_mbs = GST_ROUND_UP_16 (GST_VIDEO_INFO_WIDTH (info)) / 16;
+  guint height_mbs = GST_ROUND_UP_16 (GST_VIDEO_INFO_HEIGHT (info)) / 16;
+  guint fs = width_mbs * height_mbs;
+  gint fps_n = GST_VIDEO_INFO_FPS_N (info), fps_d = GST_VIDEO_INFO_FPS_D (info);
+  guint64 mbps;
+  guint i;
+
+  if (fps_n <= 0 || fps_d <= 0) {
+    fps_n = 30;
+    fps_d = 1;
+  }
+  mbps = gst_util_uint64_scale_ceil (fs, fps_n, fps_d);
+
+  /* Neither side may go beyond the square root of 8 frames */
+  for (i = 0; i < G_N_ELEMENTS (gst_mpp_h264_enc_levels); i++) {
+    guint max_fs = gst_mpp_h264_enc_levels[i].max_fs;
+
+    if (mbps <= gst_mpp_h264_enc_levels[i].max_mbps && fs <= max_fs
+        && width_mbs * width_mbs <= 8 * max_fs
+        && height_mbs * height_mbs <= 8 * max_fs)
+      return gst_mpp_h264_enc_levels[i].level;
+  }
+
+  return gst_mpp_h264_enc_levels[i - 1].level;
+}
+
+/* The profile downstream prefers, high unless it can't take it */
+static const gchar *
+gst_mpp_h264_enc_get_profile (GstVideoEncoder * encoder)
+{
+  const gchar *profile = "high";
+  GstStructure *structure;
+  GstCaps *allowed;
+
+  allowed = gst_pad_get_allowed_caps (GST_VIDEO_ENCODER_SRC_PAD (encoder));
+  if (allowed && !gst_caps_is_empty (allowed) && !gst_caps_is_any (allowed)) {
+    allowed = gst_caps_make_writable (gst_caps_truncate (allowed));
+    structure = gst_caps_get_structure (allowed, 0);
+    if (gst_structure_has_field (structure, "profile")) {
+      gst_structure_fixate_field_string (structure, "profile", "high");
+      profile = g_intern_string (gst_structure_get_string (structure,
+              "profile"));
+    }
+  }
+  if (allowed)
+    gst_caps_unref (allowed);
+
+  return profile;
+}
+
 static gboolean
 gst_mpp_h264_enc_set_format (GstVideoEncoder * encoder,
     GstVideoCodecState * state)
@@ -67,78 +216,67 @@ gst_mpp_h264_enc_set_format (GstVideoEncoder * encoder,
   GstMppH264Enc *self = GST_MPP_H264_ENC (encoder);
   GstMppVideoEnc *mpp_video_enc = GST_MPP_VIDEO_ENC (encoder);
   MppEncCodecCfg codec_cfg;
-  MppEncRcCfg rc_cfg;
+  guint intra_refresh, mb_rows;
 
-  memset (&rc_cfg, 0, sizeof (rc_cfg));
-  memset (&codec_cfg, 0, sizeof (codec_cfg));
+  /* The frames in flight are encoded with the previous settings */
+  if (gst_mpp_video_enc_drain (mpp_video_enc) != GST_FLOW_OK)
+    return FALSE;
 
-  rc_cfg.change = MPP_ENC_RC_CFG_CHANGE_ALL;
-  rc_cfg.rc_mode = MPP_ENC_RC_MODE_CBR;
-  rc_cfg.quality = MPP_ENC_RC_QUALITY_MEDIUM;
-
-  rc_cfg.fps_in_flex = 0;
-  rc_cfg.fps_in_num = GST_VIDEO_INFO_FPS_N (&state->info);
-  rc_cfg.fps_in_denorm = GST_VIDEO_INFO_FPS_D (&state->info);
-  rc_cfg.fps_out_flex = 0;
-  rc_cfg.fps_out_num = GST_VIDEO_INFO_FPS_N (&state->info);
-  rc_cfg.fps_out_denorm = GST_VIDEO_INFO_FPS_D (&state->info);
-  rc_cfg.gop = GST_VIDEO_INFO_FPS_N (&state->info)
-      / GST_VIDEO_INFO_FPS_D (&state->info);
-  rc_cfg.skip_cnt = 0;
-
-  codec_cfg.h264.qp_init = 26;
-
-  if (rc_cfg.rc_mode == MPP_ENC_RC_MODE_CBR) {
-    codec_cfg.h264.qp_max = 28;
-    codec_cfg.h264.qp_min = 4;
-    codec_cfg.h264.qp_max_step = 8;
-
-    /* Bits of a GOP */
-    rc_cfg.bps_target = GST_VIDEO_INFO_WIDTH (&state->info)
-        * GST_VIDEO_INFO_HEIGHT (&state->info)
-        / 8 * GST_VIDEO_INFO_FPS_N (&state->info)
-        / GST_VIDEO_INFO_FPS_D (&state->info);
-    rc_cfg.bps_max = rc_cfg.bps_target * 17 / 16;
-    rc_cfg.bps_min = rc_cfg.bps_target * 15 / 16;
-  } else if (rc_cfg.rc_mode == MPP_ENC_RC_MODE_VBR) {
-    if (rc_cfg.quality == MPP_ENC_RC_QUALITY_CQP) {
-      codec_cfg.h264.qp_max = 26;
-      codec_cfg.h264.qp_min = 26;
-      codec_cfg.h264.qp_max_step = 0;
-
-      rc_cfg.bps_target = -1;
-      rc_cfg.bps_max = -1;
-      rc_cfg.bps_min = -1;
-    } else {
-      codec_cfg.h264.qp_max = 40;
-      codec_cfg.h264.qp_min = 12;
-      codec_cfg.h264.qp_max_step = 0;
-      codec_cfg.h264.qp_init = 0;
-
-      rc_cfg.bps_target = GST_VIDEO_INFO_WIDTH (&state->info)
-          * GST_VIDEO_INFO_HEIGHT (&state->info)
-          / 8 * GST_VIDEO_INFO_FPS_N (&state->info)
-          / GST_VIDEO_INFO_FPS_D (&state->info);
-      rc_cfg.bps_max = rc_cfg.bps_target * 17 / 16;
-      rc_cfg.bps_min = rc_cfg.bps_target * 1 / 16;
-    }
-  }
+  GST_OBJECT_LOCK (self);
+  intra_refresh = self->intra_refresh;
+  mpp_video_enc->idr_on_request = intra_refresh > 0;
+  GST_OBJECT_UNLOCK (self);
 
-  if (mpp_video_enc->mpi->control (mpp_video_enc->mpp_ctx, MPP_ENC_SET_RC_CFG,
-          &rc_cfg)) {
-    GST_DEBUG_OBJECT (self, "Setting rate control for rockchip mpp failed");
+  if (!gst_mpp_h264_enc_apply_rc (self, &state->info))
     return FALSE;
-  }
+
+  memset (&codec_cfg, 0, sizeof (codec_cfg));
+
+  self->profile = gst_mpp_h264_enc_get_profile (encoder);
+  GST_DEBUG_OBJECT (self, "Using the %s profile", self->profile);
 
   codec_cfg.coding = MPP_VIDEO_CodingAVC;
   codec_cfg.h264.change = MPP_ENC_H264_CFG_CHANGE_PROFILE |
-      MPP_ENC_H264_CFG_CHANGE_ENTROPY |
-      MPP_ENC_H264_CFG_CHANGE_TRANS_8x8 | MPP_ENC_H264_CFG_CHANGE_QP_LIMIT;
-  codec_cfg.h264.profile = 100;
-  codec_cfg.h264.level = 40;
-  codec_cfg.h264.entropy_coding_mode = 1;
+      MPP_ENC_H264_CFG_CHANGE_ENTROPY | MPP_ENC_H264_CFG_CHANGE_TRANS_8x8;
+  codec_cfg.h264.level = gst_mpp_h264_enc_get_level (&state->info);
   codec_cfg.h264.cabac_init_idc = 0;
-  codec_cfg.h264.transform8x8_mode = 1;
+  GST_DEBUG_OBJECT (self, "Using level %d.%d", codec_cfg.h264.level / 10,
+      codec_cfg.h264.level % 10);
+
+  if (g_str_equal (self->profile, "baseline")) {
+    codec_cfg.h264.profile = 66;
+    codec_cfg.h264.entropy_coding_mode = 0;
+    codec_cfg.h264.transform8x8_mode = 0;
+  } else if (g_str_equal (self->profile, "main")) {
+    codec_cfg.h264.profile = 77;
+    codec_cfg.h264.entropy_coding_mode = 1;
+    codec_cfg.h264.transform8x8_mode = 0;
+  } else {
+    codec_cfg.h264.profile = 100;
+    codec_cfg.h264.entropy_coding_mode = 1;
+    codec_cfg.h264.transform8x8_mode = 1;
+  }
+
+  /* Refresh whole macroblock rows, so that each frame of the cycle holds an
+   * even share of the intra macroblocks */
+  codec_cfg.h264.change |= MPP_ENC_H264_CFG_CHANGE_INTRA_REFRESH;
+  if (intra_refresh) {
+    mb_rows = GST_ROUND_UP_16 (GST_VIDEO_INFO_HEIGHT (&state->info)) / 16;
+    codec_cfg.h264.intra_refresh_mode = 1;
+    codec_cfg.h264.intra_refresh_arg =
+        (mb_rows + intra_refresh - 1) / intra_refresh;
+    /* Rounding the rows up may shorten the cycle */
+    mpp_video_enc->refresh_period = (mb_rows +
+        codec_cfg.h264.intra_refresh_arg - 1) /
+        codec_cfg.h264.intra_refresh_arg;
+    GST_DEBUG_OBJECT (self, "Refreshing %d macroblock rows per frame, over "
+        "%u frames", codec_cfg.h264.intra_refresh_arg,
+        mpp_video_enc->refresh_period);
+  } else {
+    codec_cfg.h264.intra_refresh_mode = 0;
+    codec_cfg.h264.intra_refresh_arg = 0;
+    mpp_video_enc->refresh_period = 0;
+  }
 
   if (mpp_video_enc->mpi->control (mpp_video_enc->mpp_ctx,
           MPP_ENC_SET_CODEC_CFG, &codec_cfg)) {
@@ -149,18 +287,200 @@ gst_mpp_h264_enc_set_format (GstVideoEncoder * encoder,
   return GST_MPP_VIDEO_ENC_CLASS (parent_class)->set_format (encoder, state);
 }
 
+/* Build the avcC record out of the SPS and PPS given by MPP */
+static GstBuffer *
+gst_mpp_h264_enc_codec_data (GstMppVideoEnc * mpp_video_enc)
+{
+  const guint8 *data, *sps = NULL, *pps = NULL;
+  gsize size, offset = 0, nal_size, sps_size = 0, pps_size = 0;
+  GstBuffer *codec_data;
+  GstMapInfo map;
+  guint8 *p;
+
+  if (!mpp_video_enc->sps_packet)
+    return NULL;
+
+  data = mpp_packet_get_pos (mpp_video_enc->sps_packet);
+  size = mpp_packet_get_length (mpp_video_enc->sps_packet);
+
+  while (gst_mpp_video_enc_next_nal (data, size, &offset, &nal_size)) {
+    if (nal_size > 0) {
+      switch (data[offset] & 0x1f) {
+        case 7:
+          sps = data + offset;
+          sps_size = nal_size;
+          break;
+        case 8:
+          pps = data + offset;
+          pps_size = nal_size;
+          break;
+        default:
+          break;
+      }
+    }
+    offset += nal_size;
+  }
+
+  if (!sps || !pps || sps_size < 4)
+    return NULL;
+
+  codec_data = gst_buffer_new_allocate (NULL, 11 + sps_size + pps_size, NULL);
+  gst_buffer_map (codec_data, &map, GST_MAP_WRITE);
+  p = map.data;
+
+  p[0] = 1;                     /* version */
+  p[1] = sps[1];                /* profile */
+  p[2] = sps[2];                /* compatibility */
+  p[3] = sps[3];                /* level */
+  p[4] = 0xff;                  /* 4 bytes NAL lengths */
+  p[5] = 0xe1;                  /* 1 SPS */
+  GST_WRITE_UINT16_BE (p + 6, sps_size);
+  memcpy (p + 8, sps, sps_size);
+  p += 8 + sps_size;
+  p[0] = 1;                     /* 1 PPS */
+  GST_WRITE_UINT16_BE (p + 1, pps_size);
+  memcpy (p + 3, pps, pps_size);
+
+  gst_buffer_unmap (codec_data, &map);
+
+  return codec_data;
+}
+
+/* Recovery point SEI of a refresh cycle over @frames frames, decoding from
+ * it gives whole pictures once the cycle is over. exact_match_flag is left
+ * unset, MPP doesn't keep the motion vectors of the refreshed rows out of
+ * the rows still to refresh. The payload is too short to ever need
+ * emulation prevention. */
+static GstMemory *
+gst_mpp_h264_enc_recovery_point_sei (GstMppH264Enc * self, guint frames)
+{
+  GstMppVideoEnc *mpp_video_enc = GST_MPP_VIDEO_ENC (self);
+  guint8 sei[16], *data;
+  guint64 bits;
+  guint n_bits, len = 0;
+
+  /* recovery_frame_cnt = frames - 1 as ue(v), its code is frames with as
+   * many leading zeros as it has bits after the first one */
+  bits = frames;
+  n_bits = 2 * g_bit_storage (frames) - 1;
+  /* exact_match_flag, broken_link_flag and changing_slice_group_idc */
+  bits <<= 4;
+  n_bits += 4;
+  /* Payload alignment, a one then zeros */
+  if (n_bits % 8) {
+    bits = (bits << 1) | 1;
+    n_bits++;
+    bits <<= (8 - n_bits % 8) % 8;
+    n_bits = GST_ROUND_UP_8 (n_bits);
+  }
+
+  /* The size of a length prefixed NAL is written once known */
+  if (mpp_video_enc->length_prefixed) {
+    len = 4;
+  } else {
+    sei[len++] = 0;
+    sei[len++] = 0;
+    sei[len++] = 0;
+    sei[len++] = 1;
+  }
+  sei[len++] = 0x06;            /* nal_ref_idc 0, SEI */
+  sei[len++] = 6;               /* recovery point */
+  sei[len++] = n_bits / 8;
+  for (; n_bits; n_bits -= 8)
+    sei[len++] = bits >> (n_bits - 8);
+  sei[len++] = 0x80;            /* rbsp_trailing_bits */
+  if (mpp_video_enc->length_prefixed)
+    GST_WRITE_UINT32_BE (sei, len - 4);
+
+  data = g_memdup (sei, len);
+
+  return gst_memory_new_wrapped (GST_MEMORY_FLAG_READONLY, data, len, 0, len,
+      data, g_free);
+}
+
+static GstCaps *
+gst_mpp_h264_enc_get_outcaps (GstVideoEncoder * encoder)
+{
+  GstMppH264Enc *self = GST_MPP_H264_ENC (encoder);
+  GstMppVideoEnc *mpp_video_enc = GST_MPP_VIDEO_ENC (encoder);
+  GstBuffer *codec_data = NULL;
+  GstCaps *outcaps, *allowed;
+  const gchar *stream_format = "byte-stream";
+  const gchar *alignment = "au";
+
+  allowed = gst_pad_get_allowed_caps (GST_VIDEO_ENCODER_SRC_PAD (encoder));
+  if (allowed && !gst_caps_is_empty (allowed)) {
+    /* Keep byte-stream unless downstream only accepts avc */
+    outcaps = gst_caps_new_simple ("video/x-h264", "stream-format",
+        G_TYPE_STRING, "byte-stream", NULL);
+    if (!gst_caps_can_intersect (allowed, outcaps)) {
+      codec_data = gst_mpp_h264_enc_codec_data (mpp_video_enc);
+      if (codec_data)
+        stream_format = "avc";
+      else
+        GST_WARNING_OBJECT (encoder, "no SPS/PPS to build the codec_data");
+    }
+    gst_caps_unref (outcaps);
+
+#ifdef GST_MPP_VIDEO_ENC_SUBFRAMES
+    /* Push one buffer per slice when downstream can take them */
+    if (mpp_video_enc->slice_mode != GST_MPP_ENC_SLICE_MODE_NONE) {
+      outcaps = gst_caps_new_simple ("video/x-h264", "alignment",
+          G_TYPE_STRING, "nal", NULL);
+      if (gst_caps_can_intersect (allowed, outcaps))
+        alignment = "nal";
+      gst_caps_unref (outcaps);
+    }
+#endif
+  }
+  if (allowed)
+    gst_caps_unref (allowed);
+
+  outcaps = gst_caps_new_simple ("video/x-h264",
+      "stream-format", G_TYPE_STRING, stream_format,
+      "alignment", G_TYPE_STRING, alignment,
+      "profile", G_TYPE_STRING, self->profile, NULL);
+  if (codec_data) {
+    gst_caps_set_simple (outcaps, "codec_data", GST_TYPE_BUFFER, codec_data,
+        NULL);
+    gst_buffer_unref (codec_data);
+  }
+  mpp_video_enc->length_prefixed = codec_data != NULL;
+  mpp_video_enc->nal_aligned = g_str_equal (alignment, "nal");
+
+  /* The recovery point follows the NAL format of the stream */
+  if (mpp_video_enc->refresh_mem) {
+    gst_memory_unref (mpp_video_enc->refresh_mem);
+    mpp_video_enc->refresh_mem = NULL;
+  }
+  if (mpp_video_enc->refresh_period)
+    mpp_video_enc->refresh_mem = gst_mpp_h264_enc_recovery_point_sei (self,
+        mpp_video_enc->refresh_period);
+
+  return outcaps;
+}
+
 static GstFlowReturn
 gst_mpp_h264_enc_handle_frame (GstVideoEncoder * encoder,
     GstVideoCodecFrame * frame)
 {
-  GstCaps *outcaps;
-  GstStructure *structure;
+  GstMppH264Enc *self = GST_MPP_H264_ENC (encoder);
+  GstMppVideoEnc *mpp_video_enc = GST_MPP_VIDEO_ENC (encoder);
+  GstCaps *outcaps = NULL;
+  gboolean rc_dirty;
+
+  GST_OBJECT_LOCK (self);
+  rc_dirty = mpp_video_enc->rc_dirty;
+  GST_OBJECT_UNLOCK (self);
+
+  /* The properties changed while encoding */
+  if (rc_dirty && mpp_video_enc->input_state
+      && !gst_mpp_h264_enc_apply_rc (self, &mpp_video_enc->input_state->info))
+    GST_WARNING_OBJECT (self, "failed to update the rate control");
 
-  outcaps = gst_caps_new_empty_simple ("video/x-h264");
-  structure = gst_caps_get_structure (outcaps, 0);
-  gst_structure_set (structure, "stream-format",
-      G_TYPE_STRING, "byte-stream", NULL);
-  gst_structure_set (structure, "alignment", G_TYPE_STRING, "au", NULL);
+  /* Only needed until the output state is set */
+  if (!mpp_video_enc->outcaps)
+    outcaps = gst_mpp_h264_enc_get_outcaps (encoder);
 
   return GST_MPP_VIDEO_ENC_CLASS (parent_class)->handle_frame (encoder, frame,
       outcaps);
@@ -169,17 +489,37 @@ gst_mpp_h264_enc_handle_frame (GstVideoEncoder * encoder,
 static void
 gst_mpp_h264_enc_init (GstMppH264Enc * self)
 {
+  self->profile = "high";
+  self->intra_refresh = DEFAULT_PROP_INTRA_REFRESH;
 }
 
 static void
 gst_mpp_h264_enc_class_init (GstMppH264EncClass * klass)
 {
+  GObjectClass *gobject_class;
   GstElementClass *element_class;
   GstVideoEncoderClass *video_encoder_class;
 
+  gobject_class = (GObjectClass *) klass;
   element_class = (GstElementClass *) klass;
   video_encoder_class = (GstVideoEncoderClass *) klass;
 
+  gobject_class->set_property =
+      GST_DEBUG_FUNCPTR (gst_mpp_h264_enc_set_property);
+  gobject_class->get_property =
+      GST_DEBUG_FUNCPTR (gst_mpp_h264_enc_get_property);
+
+  gst_mpp_video_enc_install_rc_properties (gobject_class);
+
+  g_object_class_install_property (gobject_class, PROP_INTRA_REFRESH,
+      g_param_spec_uint ("intra-refresh", "Intra refresh",
+          "Spread the intra macroblock rows over this many frames instead of "
+          "sending periodic IDRs, which are then only sent on request. Each "
+          "cycle starts with the stream headers and a recovery point SEI "
+          "(0 = periodic IDRs)", 0, G_MAXUINT16, DEFAULT_PROP_INTRA_REFRESH,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
   gst_element_class_set_static_metadata (element_class,
       "Rockchip Mpp H264 Encoder",
       "Codec/Encoder/Video",
@@ -192,6 +532,10 @@ gst_mpp_h264_enc_class_init (GstMppH264EncClass * klass)
   video_encoder_class->handle_frame =
       GST_DEBUG_FUNCPTR (gst_mpp_h264_enc_handle_frame);
 
-  gst_element_class_add_pad_template (element_class,
-      gst_static_pad_template_get (&gst_mpp_h264_enc_src_template));
+  gst_mpp_video_enc_add_pad_templates (element_class, MPP_VIDEO_CodingAVC,
+      gst_caps_from_string ("video/x-h264, "
+          "framerate = (fraction) [0/1, 60/1], "
+          "stream-format = (string) { byte-stream, avc }, "
+          "alignment = (string) " GST_MPP_VIDEO_ENC_ALIGNMENTS ", "
+          "profile = (string) { high, main, baseline }"));
 }
@@ -41,6 +41,12 @@ typedef struct _GstMppH264EncClass GstMppH264EncClass;
 struct _GstMppH264Enc
 {
   GstMppVideoEnc parent;
+
+  /* Negotiated with downstream in set_format */
+  const gchar *profile;
+
+  /* Frames an intra refresh cycle is spread over, 0 for periodic IDRs */
+  guint intra_refresh;
 };
 
 struct _GstMppH264EncClass
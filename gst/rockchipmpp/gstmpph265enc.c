@@ -0,0 +1,402 @@
+/*
+ * Copyright 2017 Rockchip Electronics Co., Ltd
+ *     Author: Randy Li <randy.li@rock-chips.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <string.h>
+
+#include "gstmpph265enc.h"
+
+#define GST_CAT_DEFAULT mppvideoenc_debug
+
+#define parent_class gst_mpp_h265_enc_parent_class
+G_DEFINE_TYPE (GstMppH265Enc, gst_mpp_h265_enc, GST_TYPE_MPP_VIDEO_ENC);
+
+enum
+{
+  PROP_0,
+  MPP_ENC_RC_PROPS,
+};
+
+#define H265_NAL_VPS 32
+#define H265_NAL_SPS 33
+#define H265_NAL_PPS 34
+
+/* Main tier levels from 4.0 on, with their limits in luma samples per
+ * second and per picture */
+static const struct
+{
+  gint level;
+  guint64 max_luma_sr;
+  guint64 max_luma_ps;
+} gst_mpp_h265_enc_levels[] = {
+  {120, 66846720, 2228224},
+  {123, 133693440, 2228224},
+  {150, 267386880, 8912896},
+  {153, 534773760, 8912896},
+  {156, 1069547520, 8912896},
+  {180, 1069547520, 35651584},
+  {183, 2139095040, 35651584},
+  {186, 4278190080, 35651584},
+};
+
+/* Lowest level whose sample rate and picture size fit @info, a variable
+ * framerate is taken as 30 fps */
+static gint
+gst_mpp_h265_enc_get_level (GstVideoInfo * info)
+{
+  guint64 width = GST_VIDEO_INFO_WIDTH (info);
+  guint64 height = GST_VIDEO_INFO_HEIGHT (info);
+  gint fps_n = GST_VIDEO_INFO_FPS_N (info), fps_d = GST_VIDEO_INFO_FPS_D (info);
+  guint64 luma_sr;
+  guint i;
+
+  if (fps_n <= 0 || fps_d <= 0) {
+    fps_n = 30;
+    fps_d = 1;
+  }
+  luma_sr = gst_util_uint64_scale_ceil (width * height, fps_n, fps_d);
+
+  /* Neither side may go beyond the square root of 8 pictures */
+  for (i = 0; i < G_N_ELEMENTS (gst_mpp_h265_enc_levels); i++) {
+    guint64 max_luma_ps = gst_mpp_h265_enc_levels[i].max_luma_ps;
+
+    if (luma_sr <= gst_mpp_h265_enc_levels[i].max_luma_sr
+        && width * height <= max_luma_ps
+        && width * width <= 8 * max_luma_ps
+        && height * height <= 8 * max_luma_ps)
+      return gst_mpp_h265_enc_levels[i].level;
+  }
+
+  return gst_mpp_h265_enc_levels[i - 1].level;
+}
+
+static void
+gst_mpp_h265_enc_set_property (GObject * object,
+    guint prop_id, const GValue * value, GParamSpec * pspec)
+{
+  GstMppVideoEnc *self = GST_MPP_VIDEO_ENC (object);
+
+  if (!gst_mpp_video_enc_rc_set_property (self, prop_id, value, pspec))
+    G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+}
+
+static void
+gst_mpp_h265_enc_get_property (GObject * object,
+    guint prop_id, GValue * value, GParamSpec * pspec)
+{
+  GstMppVideoEnc *self = GST_MPP_VIDEO_ENC (object);
+
+  if (!gst_mpp_video_enc_rc_get_property (self, prop_id, value, pspec))
+    G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+}
+
+static gboolean
+gst_mpp_h265_enc_open (GstVideoEncoder * encoder)
+{
+  GstMppVideoEnc *self = GST_MPP_VIDEO_ENC (encoder);
+
+  GST_DEBUG_OBJECT (self, "Opening");
+
+  if (mpp_create (&self->mpp_ctx, &self->mpi))
+    goto failure;
+  if (mpp_init (self->mpp_ctx, MPP_CTX_ENC, MPP_VIDEO_CodingHEVC))
+    goto failure;
+
+  return TRUE;
+
+failure:
+  GST_ERROR_OBJECT (self, "failed to create the mpp context");
+  if (self->mpp_ctx) {
+    mpp_destroy (self->mpp_ctx);
+    self->mpp_ctx = NULL;
+    self->mpi = NULL;
+  }
+  return FALSE;
+}
+
+/* Push the rate control properties to MPP, fine while encoding */
+static gboolean
+gst_mpp_h265_enc_apply_rc (GstMppH265Enc * self, GstVideoInfo * info)
+{
+  GstMppVideoEnc *mpp_video_enc = GST_MPP_VIDEO_ENC (self);
+  MppEncCodecCfg codec_cfg;
+  GstMppVideoEncQp qp;
+
+  if (!gst_mpp_video_enc_set_rc_cfg (mpp_video_enc, info, &qp))
+    return FALSE;
+
+  memset (&codec_cfg, 0, sizeof (codec_cfg));
+
+  codec_cfg.coding = MPP_VIDEO_CodingHEVC;
+  codec_cfg.h265.change = MPP_ENC_H265_CFG_RC_QP_CHANGE;
+  codec_cfg.h265.qp_init = qp.init;
+  codec_cfg.h265.max_qp = qp.max;
+  codec_cfg.h265.min_qp = qp.min;
+  codec_cfg.h265.qp_max_step = qp.max_step;
+
+  if (mpp_video_enc->mpi->control (mpp_video_enc->mpp_ctx,
+          MPP_ENC_SET_CODEC_CFG, &codec_cfg)) {
+    GST_DEBUG_OBJECT (self, "Setting qp limits for rockchip mpp failed");
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static gboolean
+gst_mpp_h265_enc_set_format (GstVideoEncoder * encoder,
+    GstVideoCodecState * state)
+{
+  GstMppH265Enc *self = GST_MPP_H265_ENC (encoder);
+  GstMppVideoEnc *mpp_video_enc = GST_MPP_VIDEO_ENC (encoder);
+  MppEncCodecCfg codec_cfg;
+
+  /* The slices are counted in CTUs, whose size MPP picks per SoC, so a
+   * number of 16 pixels macroblock rows can't be converted */
+  if (mpp_video_enc->slice_mode == GST_MPP_ENC_SLICE_MODE_MB_ROWS) {
+    GST_ERROR_OBJECT (self, "slice-mode=mb-rows is not supported for H.265, "
+        "use slice-mode=bytes");
+    return FALSE;
+  }
+
+  /* The frames in flight are encoded with the previous settings */
+  if (gst_mpp_video_enc_drain (mpp_video_enc) != GST_FLOW_OK)
+    return FALSE;
+
+  if (!gst_mpp_h265_enc_apply_rc (self, &state->info))
+    return FALSE;
+
+  memset (&codec_cfg, 0, sizeof (codec_cfg));
+
+  /* Main profile, main tier */
+  codec_cfg.coding = MPP_VIDEO_CodingHEVC;
+  codec_cfg.h265.change = MPP_ENC_H265_CFG_PROFILE_LEVEL_TILER_CHANGE;
+  codec_cfg.h265.profile = 1;
+  codec_cfg.h265.level = gst_mpp_h265_enc_get_level (&state->info);
+  codec_cfg.h265.tier = 0;
+  GST_DEBUG_OBJECT (self, "Using level %d.%d", codec_cfg.h265.level / 30,
+      codec_cfg.h265.level % 30 / 3);
+
+  if (mpp_video_enc->mpi->control (mpp_video_enc->mpp_ctx,
+          MPP_ENC_SET_CODEC_CFG, &codec_cfg)) {
+    GST_DEBUG_OBJECT (self, "Setting codec info for rockchip mpp failed");
+    return FALSE;
+  }
+
+  return GST_MPP_VIDEO_ENC_CLASS (parent_class)->set_format (encoder, state);
+}
+
+/* Build the hvcC record out of the VPS, SPS and PPS given by MPP */
+static GstBuffer *
+gst_mpp_h265_enc_codec_data (GstMppVideoEnc * mpp_video_enc)
+{
+  const guint8 *data, *nals[3] = { NULL, NULL, NULL };
+  gsize size, offset = 0, nal_size, sizes[3] = { 0, 0, 0 };
+  guint8 ptl[13];
+  GstBuffer *codec_data;
+  GstMapInfo map;
+  guint8 *p;
+  gint type;
+  guint i, j;
+
+  if (!mpp_video_enc->sps_packet)
+    return NULL;
+
+  data = mpp_packet_get_pos (mpp_video_enc->sps_packet);
+  size = mpp_packet_get_length (mpp_video_enc->sps_packet);
+
+  while (gst_mpp_video_enc_next_nal (data, size, &offset, &nal_size)) {
+    if (nal_size > 0) {
+      type = (data[offset] >> 1) & 0x3f;
+      if (type >= H265_NAL_VPS && type <= H265_NAL_PPS) {
+        nals[type - H265_NAL_VPS] = data + offset;
+        sizes[type - H265_NAL_VPS] = nal_size;
+      }
+    }
+    offset += nal_size;
+  }
+
+  if (!nals[0] || !nals[1] || !nals[2])
+    return NULL;
+
+  /* The SPS header and the profile_tier_level, without the emulation
+   * prevention bytes */
+  for (i = 2, j = 0; i < sizes[1] && j < sizeof (ptl); i++) {
+    if (i >= 4 && nals[1][i] == 3 && nals[1][i - 1] == 0
+        && nals[1][i - 2] == 0)
+      continue;
+    ptl[j++] = nals[1][i];
+  }
+  if (j < sizeof (ptl))
+    return NULL;
+
+  codec_data = gst_buffer_new_allocate (NULL,
+      23 + 3 * 5 + sizes[0] + sizes[1] + sizes[2], NULL);
+  gst_buffer_map (codec_data, &map, GST_MAP_WRITE);
+  p = map.data;
+
+  p[0] = 1;                     /* version */
+  memcpy (p + 1, ptl + 1, 12);  /* profile, compatibility, level */
+  GST_WRITE_UINT16_BE (p + 13, 0xf000); /* min_spatial_segmentation */
+  p[15] = 0xfc;                 /* parallelism */
+  p[16] = 0xfd;                 /* 4:2:0 */
+  p[17] = 0xf8;                 /* 8 bits luma */
+  p[18] = 0xf8;                 /* 8 bits chroma */
+  GST_WRITE_UINT16_BE (p + 19, 0);      /* frame rate */
+  /* temporal layers, temporal id nesting, 4 bytes NAL lengths */
+  p[21] = ((((ptl[0] >> 1) & 0x7) + 1) << 3) | ((ptl[0] & 0x1) << 2) | 0x3;
+  p[22] = 3;                    /* VPS, SPS and PPS arrays */
+  p += 23;
+
+  for (i = 0; i < 3; i++) {
+    p[0] = 0x80 | (H265_NAL_VPS + i);   /* complete array */
+    GST_WRITE_UINT16_BE (p + 1, 1);
+    GST_WRITE_UINT16_BE (p + 3, sizes[i]);
+    memcpy (p + 5, nals[i], sizes[i]);
+    p += 5 + sizes[i];
+  }
+
+  gst_buffer_unmap (codec_data, &map);
+
+  return codec_data;
+}
+
+static GstCaps *
+gst_mpp_h265_enc_get_outcaps (GstVideoEncoder * encoder)
+{
+  GstMppVideoEnc *mpp_video_enc = GST_MPP_VIDEO_ENC (encoder);
+  GstBuffer *codec_data = NULL;
+  GstCaps *outcaps, *allowed;
+  const gchar *stream_format = "byte-stream";
+  const gchar *alignment = "au";
+
+  allowed = gst_pad_get_allowed_caps (GST_VIDEO_ENCODER_SRC_PAD (encoder));
+  if (allowed && !gst_caps_is_empty (allowed)) {
+    /* Keep byte-stream unless downstream only accepts hvc1 */
+    outcaps = gst_caps_new_simple ("video/x-h265", "stream-format",
+        G_TYPE_STRING, "byte-stream", NULL);
+    if (!gst_caps_can_intersect (allowed, outcaps)) {
+      codec_data = gst_mpp_h265_enc_codec_data (mpp_video_enc);
+      if (codec_data)
+        stream_format = "hvc1";
+      else
+        GST_WARNING_OBJECT (encoder, "no VPS/SPS/PPS to build the codec_data");
+    }
+    gst_caps_unref (outcaps);
+
+#ifdef GST_MPP_VIDEO_ENC_SUBFRAMES
+    /* Push the slices as they are when downstream can take them */
+    if (mpp_video_enc->slice_mode != GST_MPP_ENC_SLICE_MODE_NONE) {
+      outcaps = gst_caps_new_simple ("video/x-h265", "alignment",
+          G_TYPE_STRING, "nal", NULL);
+      if (gst_caps_can_intersect (allowed, outcaps))
+        alignment = "nal";
+      gst_caps_unref (outcaps);
+    }
+#endif
+  }
+  if (allowed)
+    gst_caps_unref (allowed);
+
+  outcaps = gst_caps_new_simple ("video/x-h265",
+      "stream-format", G_TYPE_STRING, stream_format,
+      "alignment", G_TYPE_STRING, alignment,
+      "profile", G_TYPE_STRING, "main", NULL);
+  if (codec_data) {
+    gst_caps_set_simple (outcaps, "codec_data", GST_TYPE_BUFFER, codec_data,
+        NULL);
+    gst_buffer_unref (codec_data);
+  }
+  mpp_video_enc->length_prefixed = codec_data != NULL;
+  mpp_video_enc->nal_aligned = g_str_equal (alignment, "nal");
+
+  return outcaps;
+}
+
+static GstFlowReturn
+gst_mpp_h265_enc_handle_frame (GstVideoEncoder * encoder,
+    GstVideoCodecFrame * frame)
+{
+  GstMppH265Enc *self = GST_MPP_H265_ENC (encoder);
+  GstMppVideoEnc *mpp_video_enc = GST_MPP_VIDEO_ENC (encoder);
+  GstCaps *outcaps = NULL;
+  gboolean rc_dirty;
+
+  GST_OBJECT_LOCK (self);
+  rc_dirty = mpp_video_enc->rc_dirty;
+  GST_OBJECT_UNLOCK (self);
+
+  /* The properties changed while encoding */
+  if (rc_dirty && mpp_video_enc->input_state
+      && !gst_mpp_h265_enc_apply_rc (self, &mpp_video_enc->input_state->info))
+    GST_WARNING_OBJECT (self, "failed to update the rate control");
+
+  /* Only needed until the output state is set */
+  if (!mpp_video_enc->outcaps)
+    outcaps = gst_mpp_h265_enc_get_outcaps (encoder);
+
+  return GST_MPP_VIDEO_ENC_CLASS (parent_class)->handle_frame (encoder, frame,
+      outcaps);
+}
+
+static void
+gst_mpp_h265_enc_init (GstMppH265Enc * self)
+{
+}
+
+static void
+gst_mpp_h265_enc_class_init (GstMppH265EncClass * klass)
+{
+  GObjectClass *gobject_class;
+  GstElementClass *element_class;
+  GstVideoEncoderClass *video_encoder_class;
+
+  gobject_class = (GObjectClass *) klass;
+  element_class = (GstElementClass *) klass;
+  video_encoder_class = (GstVideoEncoderClass *) klass;
+
+  gobject_class->set_property =
+      GST_DEBUG_FUNCPTR (gst_mpp_h265_enc_set_property);
+  gobject_class->get_property =
+      GST_DEBUG_FUNCPTR (gst_mpp_h265_enc_get_property);
+
+  gst_mpp_video_enc_install_rc_properties (gobject_class);
+
+  gst_element_class_set_static_metadata (element_class,
+      "Rockchip Mpp H265 Encoder",
+      "Codec/Encoder/Video",
+      "Encode video streams via Rockchip Mpp",
+      "Randy Li <randy.li@rock-chips.com>");
+
+  video_encoder_class->open = GST_DEBUG_FUNCPTR (gst_mpp_h265_enc_open);
+  video_encoder_class->set_format =
+      GST_DEBUG_FUNCPTR (gst_mpp_h265_enc_set_format);
+  video_encoder_class->handle_frame =
+      GST_DEBUG_FUNCPTR (gst_mpp_h265_enc_handle_frame);
+
+  gst_mpp_video_enc_add_pad_templates (element_class, MPP_VIDEO_CodingHEVC,
+      gst_caps_from_string ("video/x-h265, "
+          "framerate = (fraction) [0/1, 60/1], "
+          "stream-format = (string) { byte-stream, hvc1 }, "
+          "alignment = (string) " GST_MPP_VIDEO_ENC_ALIGNMENTS ", "
+          "profile = (string) { main }"));
+}
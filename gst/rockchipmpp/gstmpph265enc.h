@@ -0,0 +1,54 @@
+/*
+ * Copyright 2017 Rockchip Electronics Co., Ltd
+ *     Author: Randy Li <randy.li@rock-chips.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifndef  __GST_MPP_H265_ENC_H__
+#define  __GST_MPP_H265_ENC_H__
+
+#include "gstmppvideoenc.h"
+
+/* Begin Declaration */
+G_BEGIN_DECLS
+#define GST_TYPE_MPP_H265_ENC	(gst_mpp_h265_enc_get_type())
+#define GST_MPP_H265_ENC(obj) \
+	(G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_MPP_H265_ENC, GstMppH265Enc))
+#define GST_MPP_H265_ENC_CLASS(klass) \
+	(G_TYPE_CHECK_CLASS_CAST((klass), GST_TYPE_MPP_H265_ENC, GstMppH265EncClass))
+#define GST_IS_MPP_H265_ENC(obj) \
+	(G_TYPE_CHECK_INSTANCE_TYPE((obj), GST_TYPE_MPP_H265_ENC))
+#define GST_IS_MPP_H265_ENC_CLASS(obj) \
+	(G_TYPE_CHECK_CLASS_TYPE((klass), GST_TYPE_MPP_H265_ENC))
+typedef struct _GstMppH265Enc GstMppH265Enc;
+typedef struct _GstMppH265EncClass GstMppH265EncClass;
+
+struct _GstMppH265Enc
+{
+  GstMppVideoEnc parent;
+};
+
+struct _GstMppH265EncClass
+{
+  GstMppVideoEncClass parent_class;
+};
+
+GType gst_mpp_h265_enc_get_type (void);
+
+G_END_DECLS
+#endif /* __GST_MPP_H265_ENC_H__ */
@@ -23,7 +23,10 @@
 #include "config.h"
 #endif
 
+#include <unistd.h>
+
 #include <gst/gst.h>
+#include <gst/allocators/gstdmabuf.h>
 
 #include "gstmppbarebufferpool.h"
 #include "gstmppjpegdec.h"
@@ -35,6 +38,15 @@ GST_DEBUG_CATEGORY (mpp_jpeg_dec_debug);
 G_DEFINE_TYPE (GstMppJpegDec, gst_mpp_jpeg_dec, GST_TYPE_VIDEO_DECODER);
 
 #define NB_OUTPUT_BUFS 4        /* nb frames necessary for display pipeline */
+#define INPUT_BUF_ALIGN (1 << 16)       /* granularity of the input buffers */
+
+#define DEFAULT_PROP_CONTEXTS 1
+
+enum
+{
+  PROP_0,
+  PROP_CONTEXTS,
+};
 
 /* GstVideoDecoder base class method */
 static GstStaticPadTemplate gst_mpp_jpeg_dec_sink_template =
@@ -96,30 +108,90 @@ gst_mpp_jpeg_dec_unlock_stop (GstMppJpegDec * self)
     gst_buffer_pool_set_flushing (self->pool, FALSE);
 }
 
-static gboolean
-gst_mpp_jpeg_dec_close (GstVideoDecoder * decoder)
+static void
+gst_mpp_jpeg_dec_set_property (GObject * object,
+    guint prop_id, const GValue * value, GParamSpec * pspec)
 {
-  GstMppJpegDec *self = GST_MPP_JPEG_DEC (decoder);
-  if (self->mpp_ctx != NULL) {
-    mpp_destroy (self->mpp_ctx);
-    self->mpp_ctx = NULL;
+  GstMppJpegDec *self = GST_MPP_JPEG_DEC (object);
+
+  switch (prop_id) {
+    case PROP_CONTEXTS:
+      GST_OBJECT_LOCK (self);
+      self->req_contexts = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
   }
+}
 
-  GST_DEBUG_OBJECT (self, "Rockchip MPP context closed");
+static void
+gst_mpp_jpeg_dec_get_property (GObject * object,
+    guint prop_id, GValue * value, GParamSpec * pspec)
+{
+  GstMppJpegDec *self = GST_MPP_JPEG_DEC (object);
 
-  return TRUE;
+  switch (prop_id) {
+    case PROP_CONTEXTS:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint (value, self->req_contexts);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
 }
 
-/* Open the device */
+static void
+gst_mpp_jpeg_dec_destroy_contexts (GstMppJpegDec * self)
+{
+  guint i;
+
+  for (i = 0; i < MPP_JPEG_DEC_MAX_CONTEXTS; i++) {
+    GstMppJpegDecContext *ctx = &self->contexts[i];
+
+    if (ctx->mpp_ctx != NULL) {
+      mpp_destroy (ctx->mpp_ctx);
+      ctx->mpp_ctx = NULL;
+      ctx->mpi = NULL;
+    }
+  }
+  self->n_contexts = 0;
+
+  GST_DEBUG_OBJECT (self, "Rockchip MPP contexts closed");
+}
+
+/* The contexts are created for each stream, so a "contexts" property set
+ * in READY applies to the next one */
 static gboolean
-gst_mpp_jpeg_dec_open (GstVideoDecoder * decoder)
+gst_mpp_jpeg_dec_create_contexts (GstMppJpegDec * self)
 {
-  GstMppJpegDec *self = GST_MPP_JPEG_DEC (decoder);
-  if (mpp_create (&self->mpp_ctx, &self->mpi))
-    return FALSE;
+  guint i, n_contexts;
+
+  GST_OBJECT_LOCK (self);
+  n_contexts = self->req_contexts;
+  GST_OBJECT_UNLOCK (self);
+
+  for (i = 0; i < n_contexts; i++) {
+    GstMppJpegDecContext *ctx = &self->contexts[i];
+
+    if (mpp_create (&ctx->mpp_ctx, &ctx->mpi))
+      goto create_failed;
+
+    GST_DEBUG_OBJECT (self, "created mpp context %p", ctx->mpp_ctx);
+  }
+  self->n_contexts = n_contexts;
 
-  GST_DEBUG_OBJECT (self, "created mpp context %p", self->mpp_ctx);
   return TRUE;
+
+create_failed:
+  {
+    GST_ERROR_OBJECT (self, "failed to create mpp context %u", i);
+    gst_mpp_jpeg_dec_destroy_contexts (self);
+    return FALSE;
+  }
 }
 
 static gboolean
@@ -128,9 +200,14 @@ gst_mpp_jpeg_dec_start (GstVideoDecoder * decoder)
   GstMppJpegDec *self = GST_MPP_JPEG_DEC (decoder);
 
   GST_DEBUG_OBJECT (self, "Starting");
+  if (!gst_mpp_jpeg_dec_create_contexts (self))
+    return FALSE;
+
   gst_mpp_jpeg_dec_unlock (self);
   g_atomic_int_set (&self->active, TRUE);
   self->output_flow = GST_FLOW_OK;
+  self->next_context = 0;
+  self->pending = 0;
 
   return TRUE;
 }
@@ -138,20 +215,115 @@ gst_mpp_jpeg_dec_start (GstVideoDecoder * decoder)
 static gboolean
 gst_mpp_video_set_format (GstMppJpegDec * self, MppCodingType codec_format)
 {
-  if (mpp_init (self->mpp_ctx, MPP_CTX_DEC, codec_format))
-    return FALSE;
+  guint i;
+
+  for (i = 0; i < self->n_contexts; i++) {
+    if (mpp_init (self->contexts[i].mpp_ctx, MPP_CTX_DEC, codec_format))
+      return FALSE;
+  }
 
   return TRUE;
 }
 
+static void
+gst_mpp_jpeg_dec_context_release (GstMppJpegDecContext * ctx)
+{
+  if (ctx->mpkt)
+    mpp_packet_deinit (&ctx->mpkt);
+  if (ctx->mframe)
+    mpp_frame_deinit (&ctx->mframe);
+  if (ctx->mpp_buf) {
+    mpp_buffer_put (ctx->mpp_buf);
+    ctx->mpp_buf = NULL;
+  }
+  gst_buffer_replace (&ctx->outbuf, NULL);
+  ctx->busy = FALSE;
+}
+
+/* Wait for the frame decoded by this context and push it */
+static GstFlowReturn
+gst_mpp_jpeg_dec_collect (GstMppJpegDec * self, GstMppJpegDecContext * ctx)
+{
+  GstVideoDecoder *decoder = GST_VIDEO_DECODER (self);
+  GstVideoCodecFrame *frame;
+  GstFlowReturn ret = GST_FLOW_OK;
+  MppTask mtask = NULL;
+
+  if (!ctx->mpi->poll (ctx->mpp_ctx, MPP_PORT_OUTPUT, MPP_POLL_BLOCK))
+    ctx->mpi->dequeue (ctx->mpp_ctx, MPP_PORT_OUTPUT, &mtask);
+
+  self->pending--;
+
+  frame = gst_video_decoder_get_frame (decoder, ctx->frame_number);
+  if (frame && mtask) {
+    GST_LOG_OBJECT (self, "frame %u decoded", ctx->frame_number);
+    frame->output_buffer = ctx->outbuf;
+    ctx->outbuf = NULL;
+    ret = gst_video_decoder_finish_frame (decoder, frame);
+  } else if (frame) {
+    GST_ERROR_OBJECT (self, "failed to decode frame %u", ctx->frame_number);
+    gst_video_decoder_drop_frame (decoder, frame);
+    ret = GST_FLOW_ERROR;
+  }
+
+  if (mtask)
+    ctx->mpi->enqueue (ctx->mpp_ctx, MPP_PORT_OUTPUT, mtask);
+
+  gst_mpp_jpeg_dec_context_release (ctx);
+
+  return ret;
+}
+
+/* Push all the frames in flight, oldest first */
+static GstFlowReturn
+gst_mpp_jpeg_dec_drain (GstMppJpegDec * self)
+{
+  GstFlowReturn ret = GST_FLOW_OK;
+
+  while (self->pending > 0) {
+    GstFlowReturn collect_ret;
+    guint oldest;
+
+    oldest = (self->next_context + self->n_contexts - self->pending)
+        % self->n_contexts;
+    collect_ret = gst_mpp_jpeg_dec_collect (self, &self->contexts[oldest]);
+    if (ret == GST_FLOW_OK)
+      ret = collect_ret;
+  }
+
+  return ret;
+}
+
+/* Drop all the frames in flight */
 static gboolean
+gst_mpp_jpeg_dec_discard (GstMppJpegDec * self)
+{
+  gboolean ret = TRUE;
+  guint i;
+
+  for (i = 0; i < MPP_JPEG_DEC_MAX_CONTEXTS; i++) {
+    GstMppJpegDecContext *ctx = &self->contexts[i];
+
+    if (ctx->mpp_ctx && ctx->mpi->reset (ctx->mpp_ctx))
+      ret = FALSE;
+    if (ctx->busy)
+      gst_mpp_jpeg_dec_context_release (ctx);
+  }
+
+  self->next_context = 0;
+  self->pending = 0;
+
+  return ret;
+}
+
+static GstFlowReturn
 gst_mpp_jpeg_dec_finish (GstVideoDecoder * decoder)
 {
   GstMppJpegDec *self = GST_MPP_JPEG_DEC (decoder);
-  GstFlowReturn ret = GST_FLOW_OK;
 
-done:
-  return ret;
+  GST_DEBUG_OBJECT (self, "Finishing decoding of %u frames", self->pending);
+
+  return gst_mpp_jpeg_dec_drain (self);
 }
 
 static GstStateChangeReturn
@@ -172,6 +344,7 @@ static gboolean
 gst_mpp_jpeg_dec_stop (GstVideoDecoder * decoder)
 {
   GstMppJpegDec *self = GST_MPP_JPEG_DEC (decoder);
+  guint i;
 
   GST_DEBUG_OBJECT (self, "Stopping");
 
@@ -185,20 +358,38 @@ gst_mpp_jpeg_dec_stop (GstVideoDecoder * decoder)
   g_assert (g_atomic_int_get (&self->active) == FALSE);
 
   /* Release all the internal references of the buffer */
+  gst_mpp_jpeg_dec_discard (self);
+
   if (self->pool) {
+    gst_buffer_pool_set_active (self->pool, FALSE);
     gst_object_unref (self->pool);
     self->pool = NULL;
   }
 
-  mpp_buffer_put (self->input_buffer[0]);
-  self->input_buffer[0] = NULL;
+  for (i = 0; i < MPP_JPEG_DEC_MAX_CONTEXTS; i++) {
+    GstMppJpegDecContext *ctx = &self->contexts[i];
+
+    if (ctx->input_buffer) {
+      mpp_buffer_put (ctx->input_buffer);
+      ctx->input_buffer = NULL;
+    }
+  }
+
   if (self->input_group) {
     mpp_buffer_group_put (self->input_group);
     self->input_group = NULL;
   }
+  if (self->import_group) {
+    mpp_buffer_group_put (self->import_group);
+    self->import_group = NULL;
+  }
 
-  if (self->input_state)
+  if (self->input_state) {
     gst_video_codec_state_unref (self->input_state);
+    self->input_state = NULL;
+  }
+
+  gst_mpp_jpeg_dec_destroy_contexts (self);
 
   GST_DEBUG_OBJECT (self, "Stopped");
 
@@ -209,8 +400,9 @@ static gboolean
 gst_mpp_jpeg_dec_flush (GstVideoDecoder * decoder)
 {
   GstMppJpegDec *self = GST_MPP_JPEG_DEC (decoder);
-  gint ret = 0;
-  ret = self->mpi->reset (self->mpp_ctx);
+  gboolean ret;
+
+  ret = gst_mpp_jpeg_dec_discard (self);
 
   /* Ensure the processing thread has stopped for the reverse playback
    * discount case */
@@ -222,7 +414,129 @@ gst_mpp_jpeg_dec_flush (GstVideoDecoder * decoder)
   self->output_flow = GST_FLOW_OK;
 
   gst_mpp_jpeg_dec_unlock_stop (self);
-  return !ret;
+  return ret;
+}
+
+static gboolean
+gst_mpp_jpeg_dec_update_info (GstMppJpegDec * self, GstVideoFormat format,
+    gint width, gint height)
+{
+  GstVideoInfo *info;
+  gsize ver_stride, cr_h, mv_size;
+
+  info = &self->info;
+  gst_video_info_init (info);
+  if (!gst_video_info_set_format (info, format, width, height))
+    return FALSE;
+
+  switch (format) {
+    case GST_VIDEO_FORMAT_NV12:
+      info->stride[0] = GST_ROUND_UP_16 (info->stride[0]);
+      info->stride[1] = info->stride[0];
+      ver_stride = GST_ROUND_UP_16 (GST_VIDEO_INFO_HEIGHT (info));
+      info->offset[0] = 0;
+      info->offset[1] = info->stride[0] * ver_stride;
+      cr_h = GST_ROUND_UP_2 (ver_stride) / 2;
+      info->size = info->offset[1] + info->stride[0] * cr_h;
+      mv_size = info->size / 3;
+      info->size += mv_size;
+      break;
+    case GST_VIDEO_FORMAT_NV16:
+      info->stride[0] = GST_ROUND_UP_16 (info->stride[0]);
+      info->stride[1] = info->stride[0];
+      ver_stride = GST_ROUND_UP_16 (GST_VIDEO_INFO_HEIGHT (info));
+      info->offset[0] = 0;
+      info->offset[1] = info->stride[0] * ver_stride;
+      cr_h = GST_ROUND_UP_2 (ver_stride);
+      info->size = info->stride[0] * cr_h * 2;
+      break;
+    default:
+      g_assert_not_reached ();
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Read the dimensions and the chroma subsampling from the SOF segment */
+static gboolean
+gst_mpp_jpeg_dec_parse_sof (GstBuffer * buffer, GstVideoFormat * format,
+    gint * width, gint * height)
+{
+  GstMapInfo map;
+  const guint8 *data;
+  gsize size, i;
+  gboolean ret = FALSE;
+
+  if (!gst_buffer_map (buffer, &map, GST_MAP_READ))
+    return FALSE;
+
+  data = map.data;
+  size = map.size;
+
+  /* SOI */
+  if (size < 4 || data[0] != 0xff || data[1] != 0xd8)
+    goto done;
+
+  i = 2;
+  while (i + 4 <= size) {
+    guint8 marker;
+    guint len;
+
+    if (data[i] != 0xff)
+      break;
+
+    marker = data[i + 1];
+    /* Fill bytes */
+    if (marker == 0xff) {
+      i++;
+      continue;
+    }
+    i += 2;
+
+    /* Markers without payload */
+    if (marker == 0x01 || (marker >= 0xd0 && marker <= 0xd8))
+      continue;
+
+    /* EOI or SOS, there is no frame header before the scan */
+    if (marker == 0xd9 || marker == 0xda)
+      break;
+
+    len = GST_READ_UINT16_BE (data + i);
+    if (len < 2 || i + len > size)
+      break;
+
+    /* SOFn, except DHT, JPG and DAC */
+    if (marker >= 0xc0 && marker <= 0xcf && marker != 0xc4
+        && marker != 0xc8 && marker != 0xcc) {
+      guint n_comps;
+
+      if (len < 8)
+        break;
+
+      *height = GST_READ_UINT16_BE (data + i + 3);
+      *width = GST_READ_UINT16_BE (data + i + 5);
+      n_comps = data[i + 7];
+
+      *format = GST_VIDEO_FORMAT_NV12;
+      if (n_comps == 3 && len >= 8 + 3 * 3) {
+        guint h0 = data[i + 9] >> 4, v0 = data[i + 9] & 0x0f;
+        guint h1 = data[i + 12] >> 4, v1 = data[i + 12] & 0x0f;
+
+        if (h0 == 2 * h1 && v0 == v1)
+          *format = GST_VIDEO_FORMAT_NV16;
+      }
+
+      ret = (*width > 0 && *height > 0);
+      break;
+    }
+
+    i += len;
+  }
+
+done:
+  gst_buffer_unmap (buffer, &map);
+  return ret;
 }
 
 static gboolean
@@ -232,8 +546,6 @@ gst_mpp_jpeg_dec_set_format (GstVideoDecoder * decoder,
   GstMppJpegDec *self = GST_MPP_JPEG_DEC (decoder);
   GstStructure *structure;
   GstVideoFormat format;
-  GstVideoInfo *info;
-  gsize ver_stride, cr_h, mv_size;
 
   GST_DEBUG_OBJECT (self, "Setting format: %" GST_PTR_FORMAT, state->caps);
 
@@ -242,6 +554,8 @@ gst_mpp_jpeg_dec_set_format (GstVideoDecoder * decoder,
   if (self->input_state) {
     if (gst_caps_is_strictly_equal (self->input_state->caps, state->caps))
       goto done;
+    gst_video_codec_state_unref (self->input_state);
+    self->input_state = NULL;
   } else {
     MppCodingType codingtype;
     codingtype = to_mpp_codec (structure);
@@ -254,49 +568,24 @@ gst_mpp_jpeg_dec_set_format (GstVideoDecoder * decoder,
 
   format = gst_mpp_get_jpeg_color (structure);
   switch (format) {
-    case GST_VIDEO_FORMAT_NV12:
-    case GST_VIDEO_FORMAT_I420:
-    case GST_VIDEO_FORMAT_YV12:
-      format = GST_VIDEO_FORMAT_NV12;
-      break;
     case GST_VIDEO_FORMAT_UYVY:
     case GST_VIDEO_FORMAT_NV16:
       format = GST_VIDEO_FORMAT_NV16;
       break;
     default:
-      g_assert_not_reached ();
-      return FALSE;
-  }
-
-  info = &self->info;
-  gst_video_info_init (info);
-  gst_video_info_set_format (info, format, GST_VIDEO_INFO_WIDTH (&state->info),
-      GST_VIDEO_INFO_HEIGHT (&state->info));
-
-  switch (format) {
-    case GST_VIDEO_FORMAT_NV12:
-      info->stride[0] = GST_ROUND_UP_16 (info->stride[0]);
-      ver_stride = GST_ROUND_UP_16 (GST_VIDEO_INFO_HEIGHT (info));
-      info->offset[0] = 0;
-      info->offset[1] = info->stride[0] * ver_stride;
-      cr_h = GST_ROUND_UP_2 (ver_stride) / 2;
-      info->size = info->offset[1] + info->stride[0] * cr_h;
-      mv_size = info->size / 3;
-      info->size += mv_size;
-      break;
-    case GST_VIDEO_FORMAT_NV16:
-      info->stride[0] = GST_ROUND_UP_16 (info->stride[0]);
-      ver_stride = GST_ROUND_UP_16 (GST_VIDEO_INFO_HEIGHT (info));
-      info->offset[0] = 0;
-      info->offset[1] = info->stride[0] * ver_stride;
-      cr_h = GST_ROUND_UP_2 (ver_stride);
-      info->size = info->stride[0] * cr_h * 2;
+      format = GST_VIDEO_FORMAT_NV12;
       break;
-    default:
-      g_assert_not_reached ();
-      return FALSE;
   }
 
+  /* The real dimensions are read from each frame, the caps may not have
+   * them at all */
+  gst_video_info_init (&self->info);
+  if (GST_VIDEO_INFO_WIDTH (&state->info) > 0
+      && GST_VIDEO_INFO_HEIGHT (&state->info) > 0)
+    gst_mpp_jpeg_dec_update_info (self, format,
+        GST_VIDEO_INFO_WIDTH (&state->info),
+        GST_VIDEO_INFO_HEIGHT (&state->info));
+
   self->input_state = gst_video_codec_state_ref (state);
 
 done:
@@ -316,119 +605,285 @@ device_error:
   }
 }
 
+/* Renegotiate when the frame header differs from the current output, the
+ * pool is only rebuilt when its buffers are too small for the new frame */
+static gboolean
+gst_mpp_jpeg_dec_update_output (GstMppJpegDec * self, GstVideoFormat format,
+    gint width, gint height)
+{
+  GstVideoDecoder *decoder = GST_VIDEO_DECODER (self);
+  GstVideoCodecState *output_state;
+  GstStructure *config;
+  GstCaps *caps;
+  guint size = 0;
+
+  if (self->pool && gst_buffer_pool_is_active (self->pool)
+      && GST_VIDEO_INFO_FORMAT (&self->info) == format
+      && GST_VIDEO_INFO_WIDTH (&self->info) == width
+      && GST_VIDEO_INFO_HEIGHT (&self->info) == height)
+    return TRUE;
+
+  GST_DEBUG_OBJECT (self, "output changed to %s %dx%d",
+      gst_video_format_to_string (format), width, height);
+
+  /* The frames in flight belong to the previous caps */
+  if (gst_mpp_jpeg_dec_drain (self) != GST_FLOW_OK)
+    return FALSE;
+
+  if (!gst_mpp_jpeg_dec_update_info (self, format, width, height))
+    return FALSE;
+
+  output_state = gst_video_decoder_set_output_state (decoder, format, width,
+      height, self->input_state);
+  gst_video_codec_state_unref (output_state);
+
+  if (!gst_video_decoder_negotiate (decoder))
+    return FALSE;
+
+  if (self->pool && gst_buffer_pool_is_active (self->pool)) {
+    config = gst_buffer_pool_get_config (self->pool);
+    gst_buffer_pool_config_get_params (config, NULL, &size, NULL, NULL);
+    gst_structure_free (config);
+
+    if (size >= self->info.size) {
+      GST_DEBUG_OBJECT (self, "reusing the %u bytes buffers", size);
+      return TRUE;
+    }
+
+    /* The outstanding buffers go back to the old pool, which is freed
+     * once they are all released */
+    GST_DEBUG_OBJECT (self, "buffers of %u bytes are too small", size);
+    gst_buffer_pool_set_active (self->pool, FALSE);
+    gst_object_unref (self->pool);
+    self->pool = NULL;
+  }
+
+  if (self->pool == NULL) {
+    self->pool = gst_mpp_bare_buffer_pool_new (self, NULL);
+    if (!self->pool)
+      return FALSE;
+  }
+
+  caps = gst_pad_get_current_caps (GST_VIDEO_DECODER_SRC_PAD (decoder));
+  config = gst_buffer_pool_get_config (self->pool);
+  gst_buffer_pool_config_set_params (config, caps, self->info.size,
+      NB_OUTPUT_BUFS + self->n_contexts, NB_OUTPUT_BUFS + self->n_contexts);
+  if (caps)
+    gst_caps_unref (caps);
+
+  if (!gst_buffer_pool_set_config (self->pool, config))
+    return FALSE;
+  /* activate the pool: the buffers are allocated */
+  if (!gst_buffer_pool_set_active (self->pool, TRUE))
+    return FALSE;
+
+  return TRUE;
+}
+
+/* Import a dmabuf backed bitstream (v4l2src, our own allocator) */
+static MppBuffer
+gst_mpp_jpeg_dec_import_input (GstMppJpegDec * self, GstBuffer * inbuf)
+{
+  GstMemory *mem;
+  GstMppMemory *mpp_mem;
+  MppBufferInfo commit = { 0, };
+  MppBuffer mpp_buf = NULL;
+  gsize offset, maxsize;
+
+  if (gst_buffer_n_memory (inbuf) != 1)
+    return NULL;
+
+  mem = gst_buffer_peek_memory (inbuf, 0);
+  if (!gst_is_dmabuf_memory (mem))
+    return NULL;
+
+  /* The hardware always reads the bitstream from the start of the buffer */
+  gst_memory_get_sizes (mem, &offset, &maxsize);
+  if (offset != 0)
+    return NULL;
+
+  mpp_mem = gst_mini_object_get_qdata (GST_MINI_OBJECT (mem),
+      GST_MPP_MEMORY_QUARK);
+  if (mpp_mem && gst_is_mpp_memory (GST_MEMORY_CAST (mpp_mem))) {
+    mpp_buffer_inc_ref (mpp_mem->mpp_buf);
+    return mpp_mem->mpp_buf;
+  }
+
+  if (!self->import_group) {
+    mpp_buffer_group_get_external (&self->import_group,
+        MPP_BUFFER_TYPE_EXT_DMA);
+    if (!self->import_group)
+      return NULL;
+  }
+
+  commit.type = MPP_BUFFER_TYPE_EXT_DMA;
+  commit.fd = dup (gst_dmabuf_memory_get_fd (mem));
+  commit.size = maxsize;
+  if (commit.fd < 0)
+    return NULL;
+
+  if (mpp_buffer_import_with_tag (self->import_group, &commit, &mpp_buf,
+          NULL, __FUNCTION__)) {
+    GST_WARNING_OBJECT (self, "failed to import dmabuf %d", commit.fd);
+    close (commit.fd);
+    return NULL;
+  }
+
+  GST_LOG_OBJECT (self, "imported dmabuf fd %d", commit.fd);
+
+  return mpp_buf;
+}
+
+/* Copy the bitstream into the input buffer of the context, growing it when
+ * the payload doesn't fit */
+static MppBuffer
+gst_mpp_jpeg_dec_copy_input (GstMppJpegDec * self, GstMppJpegDecContext * ctx,
+    GstBuffer * inbuf)
+{
+  MppBuffer *mpp_buf;
+  gsize size;
+
+  size = gst_buffer_get_size (inbuf);
+
+  mpp_buf = &ctx->input_buffer;
+
+  if (*mpp_buf && mpp_buffer_get_size (*mpp_buf) < size) {
+    mpp_buffer_put (*mpp_buf);
+    *mpp_buf = NULL;
+  }
+
+  if (!*mpp_buf) {
+    gsize alloc_size = GST_ROUND_UP_N (size, INPUT_BUF_ALIGN);
+
+    GST_DEBUG_OBJECT (self, "allocating %" G_GSIZE_FORMAT
+        " bytes input buffer", alloc_size);
+    if (mpp_buffer_get (self->input_group, mpp_buf, alloc_size))
+      return NULL;
+  }
+
+  gst_buffer_extract (inbuf, 0, mpp_buffer_get_ptr (*mpp_buf), size);
+
+  mpp_buffer_inc_ref (*mpp_buf);
+  return *mpp_buf;
+}
+
+/* Wrap the compressed bitstream into a MppPacket, the MppBuffer returned
+ * must be released with mpp_buffer_put() once the frame is decoded */
+static MppBuffer
+gst_mpp_jpeg_dec_prepare_packet (GstMppJpegDec * self,
+    GstMppJpegDecContext * ctx, GstBuffer * inbuf, MppPacket * mpkt)
+{
+  MppBuffer mpp_buf;
+  gsize size;
+
+  size = gst_buffer_get_size (inbuf);
+
+  mpp_buf = gst_mpp_jpeg_dec_import_input (self, inbuf);
+  if (!mpp_buf)
+    mpp_buf = gst_mpp_jpeg_dec_copy_input (self, ctx, inbuf);
+  if (!mpp_buf)
+    return NULL;
+
+  mpp_packet_init_with_buffer (mpkt, mpp_buf);
+  mpp_packet_set_length (*mpkt, size);
+
+  return mpp_buf;
+}
+
 static GstFlowReturn
 gst_mpp_jpeg_dec_handle_frame (GstVideoDecoder * decoder,
     GstVideoCodecFrame * frame)
 {
   GstMppJpegDec *self = GST_MPP_JPEG_DEC (decoder);
-  GstBufferPool *pool = NULL;
+  GstMppJpegDecContext *ctx = NULL;
   GstFlowReturn ret = GST_FLOW_OK;
-  GstBuffer *outbuf = NULL;
-  MppPacket mpkt = NULL;
+  GstVideoFormat format;
+  GstVideoInfo *info;
+  GstVideoMeta *vmeta;
+  gint width, height;
   MPP_RET mret = 0;
   MppTask mtask = NULL;
-  MppFrame mframe = NULL;
 
   GST_DEBUG_OBJECT (self, "Handling frame %d", frame->system_frame_number);
 
   if (G_UNLIKELY (!g_atomic_int_get (&self->active)))
     goto flushing;
 
-  if (self->pool == NULL) {
-    if (!self->input_state)
-      goto not_negotiated;
+  if (!self->input_state)
+    goto not_negotiated;
 
-    self->pool = gst_mpp_bare_buffer_pool_new (self, NULL);
-    if (!self->pool)
+  if (!gst_mpp_jpeg_dec_parse_sof (frame->input_buffer, &format, &width,
+          &height)) {
+    GST_WARNING_OBJECT (self, "no frame header found, using the caps");
+    format = GST_VIDEO_INFO_FORMAT (&self->info);
+    width = GST_VIDEO_INFO_WIDTH (&self->info);
+    height = GST_VIDEO_INFO_HEIGHT (&self->info);
+    if (format == GST_VIDEO_FORMAT_UNKNOWN || width <= 0 || height <= 0)
       goto not_negotiated;
   }
 
-  pool = GST_BUFFER_POOL (self->pool);
-  if (!gst_buffer_pool_is_active (pool)) {
-    GstVideoCodecState *output_state;
-    GstVideoInfo *info = &self->info;
-    GstStructure *config = gst_buffer_pool_get_config (pool);
-
-    output_state =
-        gst_video_decoder_set_output_state (decoder,
-        info->finfo->format, info->width, info->height, self->input_state);
-    gst_video_codec_state_unref (output_state);
-
-    gst_buffer_pool_config_set_params (config, output_state->caps,
-        self->info.size, NB_OUTPUT_BUFS, NB_OUTPUT_BUFS);
-
-    if (!gst_buffer_pool_set_config (pool, config))
-      goto error_activate_pool;
-    /* activate the pool: the buffers are allocated */
-    if (gst_buffer_pool_set_active (self->pool, TRUE) == FALSE)
-      goto error_activate_pool;
+  if (!gst_mpp_jpeg_dec_update_output (self, format, width, height))
+    goto error_activate_pool;
 
+  if (!self->input_group) {
     if (mpp_buffer_group_get_internal (&self->input_group, MPP_BUFFER_TYPE_ION))
       goto error_activate_pool;
-
-    mpp_buffer_get (self->input_group, &self->input_buffer[0], self->info.size);
-
   }
-#if 0
-  ret = gst_buffer_pool_acquire_buffer (self->pool, &tmp, NULL);
-  if (ret != GST_FLOW_OK)
-    goto drop;
-#endif
 
-  ret = gst_buffer_pool_acquire_buffer (self->pool, &outbuf, NULL);
+  /* The context is always idle here, the oldest frame is collected as soon
+   * as all of them are busy */
+  ctx = &self->contexts[self->next_context];
+  g_assert (!ctx->busy);
+
+  ret = gst_buffer_pool_acquire_buffer (self->pool, &ctx->outbuf, NULL);
   if (ret != GST_FLOW_OK)
     goto drop;
 
-  if (self->mpi->poll (self->mpp_ctx, MPP_PORT_INPUT, MPP_POLL_BLOCK))
+  /* The buffers may be larger than this frame, describe the layout */
+  info = &self->info;
+  vmeta = gst_buffer_get_video_meta (ctx->outbuf);
+  if (vmeta)
+    gst_buffer_remove_meta (ctx->outbuf, (GstMeta *) vmeta);
+  gst_buffer_add_video_meta_full (ctx->outbuf, GST_VIDEO_FRAME_FLAG_NONE,
+      GST_VIDEO_INFO_FORMAT (info), GST_VIDEO_INFO_WIDTH (info),
+      GST_VIDEO_INFO_HEIGHT (info), GST_VIDEO_INFO_N_PLANES (info),
+      info->offset, info->stride);
+
+  if (ctx->mpi->poll (ctx->mpp_ctx, MPP_PORT_INPUT, MPP_POLL_BLOCK))
     goto start_task_failed;
-  if (self->mpi->dequeue (self->mpp_ctx, MPP_PORT_INPUT, &mtask))
+  if (ctx->mpi->dequeue (ctx->mpp_ctx, MPP_PORT_INPUT, &mtask))
     goto drop;
 
-#if 0
-  mpp_packet_new (&mpkt);
-  gst_buffer_copy_into (tmp, frame->input_buffer, GST_BUFFER_COPY_MEMORY, 0,
-      -1);
-  if (ret != GST_FLOW_OK)
+  ctx->mpp_buf = gst_mpp_jpeg_dec_prepare_packet (self, ctx,
+      frame->input_buffer, &ctx->mpkt);
+  if (!ctx->mpp_buf)
     goto drop;
-#else
-  /* FIXME: performance bad */
-  gst_buffer_extract (frame->input_buffer, 0,
-      mpp_buffer_get_ptr (self->input_buffer[0]),
-      gst_buffer_get_size (frame->input_buffer));
-
-  mpp_packet_init_with_buffer (&mpkt, self->input_buffer[0]);
-#endif
-  mpp_task_meta_set_packet (mtask, KEY_INPUT_PACKET, mpkt);
+  mpp_task_meta_set_packet (mtask, KEY_INPUT_PACKET, ctx->mpkt);
 
-  mpp_frame_init (&mframe);
-  ret = gst_mpp_bare_buffer_pool_fill_frame (mframe, outbuf);
+  mpp_frame_init (&ctx->mframe);
+  ret = gst_mpp_bare_buffer_pool_fill_frame (ctx->mframe, ctx->outbuf);
   if (ret != GST_FLOW_OK)
     goto drop;
 
-  mpp_task_meta_set_frame (mtask, KEY_OUTPUT_FRAME, mframe);
+  mpp_task_meta_set_frame (mtask, KEY_OUTPUT_FRAME, ctx->mframe);
 
-  if (self->mpi->enqueue (self->mpp_ctx, MPP_PORT_INPUT, mtask))
+  if ((mret = ctx->mpi->enqueue (ctx->mpp_ctx, MPP_PORT_INPUT, mtask)))
     goto send_stream_error;
 
-  if (self->mpi->poll (self->mpp_ctx, MPP_PORT_OUTPUT, MPP_POLL_BLOCK))
-    goto send_stream_error;
-
-  mpp_packet_deinit (&mpkt);
+  ctx->busy = TRUE;
+  ctx->frame_number = frame->system_frame_number;
+  self->next_context = (self->next_context + 1) % self->n_contexts;
+  self->pending++;
 
-  mret = self->mpi->dequeue (self->mpp_ctx, MPP_PORT_OUTPUT, &mtask);
-  if (mtask) {
-    GstVideoCodecFrame *frame = NULL;
-
-    frame = gst_video_decoder_get_oldest_frame (decoder);
-    frame->output_buffer = outbuf;
-    ret = gst_video_decoder_finish_frame (decoder, frame);
-    mret = self->mpi->enqueue (self->mpp_ctx, MPP_PORT_OUTPUT, mtask);
-    mpp_frame_deinit (&mframe);
-  }
+  /* The frame is kept in the list of the base class */
+  gst_video_codec_frame_unref (frame);
 
-  /* No need to keep input arround */
+  /* Every context is busy, wait for the oldest one, which is the next one
+   * to be used. So the frames are always finished in order */
+  if (self->pending == self->n_contexts)
+    ret = gst_mpp_jpeg_dec_collect (self,
+        &self->contexts[self->next_context]);
 
-  gst_video_codec_frame_unref (frame);
   return ret;
 
   /* ERRORS */
@@ -448,7 +903,7 @@ start_task_failed:
     GST_ELEMENT_ERROR (self, RESOURCE, FAILED,
         ("Failed to start decoding thread."), (NULL));
     ret = GST_FLOW_ERROR;
-    goto drop;
+    goto drop_context;
   }
 not_negotiated:
   {
@@ -459,12 +914,20 @@ not_negotiated:
 send_stream_error:
   {
     GST_ERROR_OBJECT (self, "send packet failed %d", mret);
-    mpp_packet_deinit (&mpkt);
-    return GST_FLOW_ERROR;
+    ret = GST_FLOW_ERROR;
+    goto drop_context;
   }
 drop:
+  {
+    if (ret == GST_FLOW_OK)
+      ret = GST_FLOW_ERROR;
+    goto drop_context;
+  }
+drop_context:
   {
     GST_ERROR_OBJECT (self, "can't process this frame");
+    if (ctx)
+      gst_mpp_jpeg_dec_context_release (ctx);
     gst_video_decoder_drop_frame (decoder, frame);
     return ret;
   }
@@ -474,16 +937,28 @@ static void
 gst_mpp_jpeg_dec_class_init (GstMppJpegDecClass * klass)
 {
   GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+  GObjectClass *gobject_class = (GObjectClass *) klass;
   GstVideoDecoderClass *video_decoder_class = GST_VIDEO_DECODER_CLASS (klass);
 
+  gobject_class->set_property =
+      GST_DEBUG_FUNCPTR (gst_mpp_jpeg_dec_set_property);
+  gobject_class->get_property =
+      GST_DEBUG_FUNCPTR (gst_mpp_jpeg_dec_get_property);
+
+  g_object_class_install_property (gobject_class, PROP_CONTEXTS,
+      g_param_spec_uint ("contexts", "Contexts",
+          "Number of MPP contexts decoding in parallel, frames are "
+          "dispatched to them in turn (batch mode)",
+          1, MPP_JPEG_DEC_MAX_CONTEXTS, DEFAULT_PROP_CONTEXTS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
   gst_element_class_add_pad_template (element_class,
       gst_static_pad_template_get (&gst_mpp_jpeg_dec_src_template));
 
   gst_element_class_add_pad_template (element_class,
       gst_static_pad_template_get (&gst_mpp_jpeg_dec_sink_template));
 
-  video_decoder_class->open = GST_DEBUG_FUNCPTR (gst_mpp_jpeg_dec_open);
-  video_decoder_class->close = GST_DEBUG_FUNCPTR (gst_mpp_jpeg_dec_close);
   video_decoder_class->start = GST_DEBUG_FUNCPTR (gst_mpp_jpeg_dec_start);
   video_decoder_class->stop = GST_DEBUG_FUNCPTR (gst_mpp_jpeg_dec_stop);
   video_decoder_class->finish = GST_DEBUG_FUNCPTR (gst_mpp_jpeg_dec_finish);
@@ -512,6 +987,8 @@ gst_mpp_jpeg_dec_init (GstMppJpegDec * self)
   gst_video_decoder_set_packetized (decoder, TRUE);
 
   self->active = FALSE;
+  self->req_contexts = DEFAULT_PROP_CONTEXTS;
+  self->n_contexts = 0;
 
   self->input_state = NULL;
 }
@@ -42,6 +42,25 @@ G_BEGIN_DECLS
 	(G_TYPE_CHECK_CLASS_TYPE((klass), GST_TYPE_MPP_JPEG_DEC))
 typedef struct _GstMppJpegDec GstMppJpegDec;
 typedef struct _GstMppJpegDecClass GstMppJpegDecClass;
+typedef struct _GstMppJpegDecContext GstMppJpegDecContext;
+
+#define MPP_JPEG_DEC_MAX_CONTEXTS       8
+
+/* A MPP instance and the frame it is decoding */
+struct _GstMppJpegDecContext
+{
+  MppCtx mpp_ctx;
+  MppApi *mpi;
+  MppBuffer input_buffer;
+
+  /* In flight frame */
+  gboolean busy;
+  guint32 frame_number;
+  GstBuffer *outbuf;
+  MppPacket mpkt;
+  MppFrame mframe;
+  MppBuffer mpp_buf;
+};
 
 struct _GstMppJpegDec
 {
@@ -61,11 +80,14 @@ struct _GstMppJpegDec
   gboolean active;
   GstFlowReturn output_flow;
 
-  /* Rockchip Mpp definitions */
-  MppCtx mpp_ctx;
-  MppApi *mpi;
+  /* Rockchip Mpp definitions, frames are dispatched round-robin */
+  GstMppJpegDecContext contexts[MPP_JPEG_DEC_MAX_CONTEXTS];
+  guint req_contexts;           /* "contexts" property */
+  guint n_contexts;             /* contexts created in start() */
+  guint next_context;
+  guint pending;
   MppBufferGroup input_group;
-  MppBuffer input_buffer[2];
+  MppBufferGroup import_group;
 
   GstBufferPool *pool;          /* Pool of output frames */
 };
@@ -30,16 +30,6 @@
 #define parent_class gst_mpp_jpeg_enc_parent_class
 G_DEFINE_TYPE (GstMppJpegEnc, gst_mpp_jpeg_enc, GST_TYPE_MPP_VIDEO_ENC);
 
-static GstStaticPadTemplate gst_mpp_jpeg_enc_src_template =
-GST_STATIC_PAD_TEMPLATE ("src",
-    GST_PAD_SRC,
-    GST_PAD_ALWAYS,
-    GST_STATIC_CAPS ("image/jpeg, "
-        "width  = (int) [ 96, 8192 ], " "height = (int) [ 32, 8192 ], "
-        /* Up to 90 million pixels per second at the rk3399 */
-        "framerate = (fraction) [0/1, 60/1], " "sof-marker = { 0 }")
-    );
-
 static gboolean
 gst_mpp_jpeg_enc_open (GstVideoEncoder * encoder)
 {
@@ -55,6 +45,12 @@ gst_mpp_jpeg_enc_open (GstVideoEncoder * encoder)
   return TRUE;
 
 failure:
+  GST_ERROR_OBJECT (self, "failed to create the mpp context");
+  if (self->mpp_ctx) {
+    mpp_destroy (self->mpp_ctx);
+    self->mpp_ctx = NULL;
+    self->mpi = NULL;
+  }
   return FALSE;
 }
 
@@ -67,6 +63,10 @@ gst_mpp_jpeg_enc_set_format (GstVideoEncoder * encoder,
   MppEncCodecCfg codec_cfg;
   MppEncRcCfg rc_cfg;
 
+  /* The frames in flight are encoded with the previous settings */
+  if (gst_mpp_video_enc_drain (mpp_video_enc) != GST_FLOW_OK)
+    return FALSE;
+
   memset (&rc_cfg, 0, sizeof (rc_cfg));
   memset (&codec_cfg, 0, sizeof (codec_cfg));
 
@@ -142,6 +142,9 @@ gst_mpp_jpeg_enc_class_init (GstMppJpegEncClass * klass)
   video_encoder_class->handle_frame =
       GST_DEBUG_FUNCPTR (gst_mpp_jpeg_enc_handle_frame);
 
-  gst_element_class_add_pad_template (element_class,
-      gst_static_pad_template_get (&gst_mpp_jpeg_enc_src_template));
+  gst_mpp_video_enc_add_pad_templates (element_class, MPP_VIDEO_CodingMJPEG,
+      gst_caps_from_string ("image/jpeg, "
+          "width  = (int) [ 96, 8192 ], " "height = (int) [ 32, 8192 ], "
+          /* Up to 90 million pixels per second at the rk3399 */
+          "framerate = (fraction) [0/1, 60/1], " "sof-marker = { 0 }"));
 }
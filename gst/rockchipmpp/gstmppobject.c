@@ -559,6 +559,11 @@ gst_mpp_object_setup_pool (GstMppObject * self, GstCaps * caps)
       /* FIXME get the minimum buffers requested from decoder parser */
       self->min_buffers = 16;
       break;
+    case GST_MPP_ENC_INPUT:
+      /* Offered to upstream, which renders the raw frames into it */
+      self->pool = gst_mpp_buffer_pool_new (self, caps);
+      self->min_buffers = GST_MPP_MIN_BUFFERS;
+      break;
     default:
       return FALSE;
   }
@@ -571,7 +576,13 @@ void
 gst_mpp_object_close_pool (GstMppObject * self)
 {
   if (self->pool != NULL) {
-    self->mpi->reset (self->mpp_ctx);
+    /* The pool of the encoder input is only lent to upstream, there is no
+     * mpp context behind it. It is stopped once upstream returns the
+     * buffers it still holds */
+    if (self->type == GST_MPP_ENC_INPUT)
+      gst_buffer_pool_set_active (self->pool, FALSE);
+    else if (self->mpp_ctx)
+      self->mpi->reset (self->mpp_ctx);
     gst_object_unref (self->pool);
     self->pool = NULL;
   }
@@ -611,6 +622,7 @@ gst_mpp_object_config_pool (GstMppObject * self, gpointer pool)
       self->mpi->control (self->mpp_ctx, MPP_DEC_SET_EXT_BUF_GROUP, pool);
       break;
     case GST_MPP_DEC_INPUT:
+    case GST_MPP_ENC_INPUT:
       break;
     default:
       g_assert_not_reached ();
@@ -0,0 +1,102 @@
+/*
+ * Copyright 2017 Rockchip Electronics Co., Ltd
+ *     Author: Randy Li <randy.li@rock-chips.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "gstmpproi.h"
+
+/*
+ * Map the GstVideoRegionOfInterestMeta of a frame to the regions of the
+ * encoder, kept free of MPP so it can be checked without the hardware.
+ *
+ * The regions are clipped to the frame and grown to whole macroblocks, a
+ * region which then lies within a previous one is merged into it, so it
+ * doesn't take one of the few regions of the encoder.
+ * When bg_qp_delta is set, a region covering the whole frame comes first
+ * and the regions of interest, coming later, take precedence over it, even
+ * with a roi_qp_delta of 0.
+ * Nothing is returned for a frame without any region of interest.
+ */
+guint
+gst_mpp_roi_from_buffer (GstBuffer * buffer, const GstVideoInfo * info,
+    gint roi_qp_delta, gint bg_qp_delta, GstMppRoiRegion * regions,
+    guint max_regions)
+{
+  GstVideoRegionOfInterestMeta *meta;
+  gpointer state = NULL;
+  guint width = GST_VIDEO_INFO_WIDTH (info);
+  guint height = GST_VIDEO_INFO_HEIGHT (info);
+  guint n = 0, first, i;
+
+  if (max_regions == 0 || (roi_qp_delta == 0 && bg_qp_delta == 0))
+    return 0;
+
+  if (bg_qp_delta && max_regions > 1) {
+    regions[0].x = 0;
+    regions[0].y = 0;
+    regions[0].w = GST_ROUND_UP_16 (width);
+    regions[0].h = GST_ROUND_UP_16 (height);
+    regions[0].qp_delta = bg_qp_delta;
+    n = 1;
+  }
+  first = n;
+
+  while (n < max_regions && (meta = (GstVideoRegionOfInterestMeta *)
+          gst_buffer_iterate_meta_filtered (buffer, &state,
+              GST_VIDEO_REGION_OF_INTEREST_META_API_TYPE))) {
+    guint x0, y0, x1, y1;
+
+    /* The last macroblocks may go past the frame, not the region */
+    if (meta->x >= width || meta->y >= height || meta->w == 0 || meta->h == 0)
+      continue;
+
+    x0 = MIN (meta->x, width) & ~(GST_MPP_ROI_ALIGN - 1);
+    y0 = MIN (meta->y, height) & ~(GST_MPP_ROI_ALIGN - 1);
+    x1 = GST_ROUND_UP_16 (MIN (meta->x + meta->w, width));
+    y1 = GST_ROUND_UP_16 (MIN (meta->y + meta->h, height));
+    if (x1 <= x0 || y1 <= y0)
+      continue;
+
+    for (i = first; i < n; i++) {
+      if (x0 >= regions[i].x && y0 >= regions[i].y
+          && x1 <= regions[i].x + regions[i].w
+          && y1 <= regions[i].y + regions[i].h)
+        break;
+    }
+    if (i < n)
+      continue;
+
+    regions[n].x = x0;
+    regions[n].y = y0;
+    regions[n].w = x1 - x0;
+    regions[n].h = y1 - y0;
+    regions[n].qp_delta = roi_qp_delta;
+    n++;
+  }
+
+  /* Only the background, the whole frame is left as it is */
+  if (n == first)
+    return 0;
+
+  return n;
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright 2017 Rockchip Electronics Co., Ltd
+ *     Author: Randy Li <randy.li@rock-chips.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifndef __GST_MPP_ROI_H__
+#define __GST_MPP_ROI_H__
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+G_BEGIN_DECLS
+
+/* Regions are aligned on macroblocks */
+#define GST_MPP_ROI_ALIGN	16
+
+typedef struct _GstMppRoiRegion GstMppRoiRegion;
+
+struct _GstMppRoiRegion
+{
+  guint x;
+  guint y;
+  guint w;
+  guint h;
+  gint qp_delta;
+};
+
+guint gst_mpp_roi_from_buffer (GstBuffer * buffer, const GstVideoInfo * info,
+    gint roi_qp_delta, gint bg_qp_delta, GstMppRoiRegion * regions,
+    guint max_regions);
+
+G_END_DECLS
+
+#endif /* __GST_MPP_ROI_H__ */
@@ -22,7 +22,15 @@
 #include "config.h"
 #endif
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include <gst/allocators/gstdmabuf.h>
+#ifdef HAVE_MPP_ENC_REF_CFG
+#include <rockchip/rk_venc_ref.h>
+#endif
+
+#include "gstmppallocator.h"
 #include "gstmppvideoenc.h"
 
 GST_DEBUG_CATEGORY (mppvideoenc_debug);
@@ -32,41 +40,744 @@ GST_DEBUG_CATEGORY (mppvideoenc_debug);
 G_DEFINE_ABSTRACT_TYPE (GstMppVideoEnc, gst_mpp_video_enc,
     GST_TYPE_VIDEO_ENCODER);
 
-static GstStaticPadTemplate gst_mpp_video_enc_sink_template =
-    GST_STATIC_PAD_TEMPLATE ("sink",
-    GST_PAD_SINK,
-    GST_PAD_ALWAYS,
-    GST_STATIC_CAPS ("video/x-raw,"
-        "format = (string) NV12, "
-        "width  = (int) [ 32, 1920 ], "
-        "height = (int) [ 32, 1088 ], "
-        "framerate = (fraction) [0/1, 60/1]"
-        ";"
-        "video/x-raw,"
-        "format = (string) I420, "
-        "width  = (int) [ 32, 1920 ], "
-        "height = (int) [ 32, 1088 ], "
-        "framerate = (fraction) [0/1, 60/1]"
-        ";"
-        "video/x-raw,"
-        "format = (string) YUY2, "
-        "width  = (int) [ 32, 1920 ], "
-        "height = (int) [ 32, 1088 ], "
-        "framerate = (fraction) [0/1, 60/1]"
-        ";"
-        "video/x-raw,"
-        "format = (string) UYVY, "
-        "width  = (int) [ 32, 1920 ], "
-        "height = (int) [ 32, 1088 ], "
-        "framerate = (fraction) [0/1, 60/1]" ";"));
+/* Every SoC encodes 1080p, the ones missing from the table below are only
+ * trusted with that */
+#define MPP_ENC_DEFAULT_MAX_WIDTH 1920
+#define MPP_ENC_DEFAULT_MAX_HEIGHT 1088
+#define MPP_JPEG_ENC_MAX_SIZE 8192
+
+/* Limits of the video encoders, MPP has no way to query them. A SoC has to
+ * be listed here to be offered more than 1080p. */
+static const struct
+{
+  const gchar *compatible;
+  gint max_width;
+  gint max_height;
+} gst_mpp_video_enc_socs[] = {
+  {"rockchip,rk3036", 1920, 1088},
+  {"rockchip,rk3126", 1920, 1088},
+  {"rockchip,rk3128", 1920, 1088},
+  {"rockchip,rk3228", 1920, 1088},
+  {"rockchip,rk3229", 1920, 1088},
+  {"rockchip,rk3288", 1920, 1088},
+  {"rockchip,rk3326", 1920, 1088},
+  {"rockchip,px30", 1920, 1088},
+  {"rockchip,rk3328", 1920, 1088},
+  {"rockchip,rk3368", 1920, 1088},
+  {"rockchip,rk3399", 1920, 1088},
+  {"rockchip,rk3528", 1920, 1088},
+  {"rockchip,rk3562", 1920, 1088},
+  {"rockchip,rv1106", 2304, 1536},
+  {"rockchip,rv1103", 2304, 1536},
+  {"rockchip,rv1109", 4096, 2304},
+  {"rockchip,rv1126", 4096, 2304},
+  {"rockchip,rk3566", 4096, 2304},
+  {"rockchip,rk3568", 4096, 2304},
+  {"rockchip,rk3576", 4096, 2304},
+  {"rockchip,rk3588", 8192, 8192},
+  {"rockchip,rk3588s", 8192, 8192},
+};
+
+#define DEFAULT_PROP_MAX_PENDING 4
+#define DEFAULT_PROP_SLICE_MODE GST_MPP_ENC_SLICE_MODE_NONE
+#define DEFAULT_PROP_SLICE_SIZE 0
+#define DEFAULT_PROP_ROI_QP_DELTA -6
+#define DEFAULT_PROP_BG_QP_DELTA 0
+#define DEFAULT_PROP_REALTIME FALSE
+#define DEFAULT_PROP_RC_MODE GST_MPP_ENC_RC_MODE_CBR
+#define DEFAULT_PROP_BITRATE 0  /* w * h / 8 * fps */
+#define DEFAULT_PROP_MAX_BITRATE 0      /* 17/16 of the bitrate */
+#define DEFAULT_PROP_GOP 0      /* one second */
+#define DEFAULT_PROP_QP -1      /* depends on the rc-mode */
+#define DEFAULT_PROP_VI_INTERVAL 0
+/* IDR interval of Smart P when the gop is left unset */
+#define MPP_ENC_SMART_P_GOP_SECONDS 10
+#define MPP_MAX_IMPORTS 32      /* imported dmabufs kept in the cache */
+
+enum
+{
+  PROP_0,
+  PROP_MAX_PENDING,
+  PROP_SLICE_MODE,
+  PROP_SLICE_SIZE,
+  PROP_ROI_QP_DELTA,
+  PROP_BG_QP_DELTA,
+  PROP_REALTIME,
+  PROP_STATS,
+};
+
+/* Installed by the codecs with a rate control */
+enum
+{
+  PROP_RC_0,
+  MPP_ENC_RC_PROPS,
+};
+
+static void
+gst_mpp_video_enc_set_property (GObject * object,
+    guint prop_id, const GValue * value, GParamSpec * pspec)
+{
+  GstMppVideoEnc *self = GST_MPP_VIDEO_ENC (object);
+
+  switch (prop_id) {
+    case PROP_MAX_PENDING:
+      GST_OBJECT_LOCK (self);
+      self->max_pending = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_SLICE_MODE:
+      GST_OBJECT_LOCK (self);
+      self->slice_mode = g_value_get_enum (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_SLICE_SIZE:
+      GST_OBJECT_LOCK (self);
+      self->slice_size = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_ROI_QP_DELTA:
+      GST_OBJECT_LOCK (self);
+      self->roi_qp_delta = g_value_get_int (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_BG_QP_DELTA:
+      GST_OBJECT_LOCK (self);
+      self->bg_qp_delta = g_value_get_int (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_REALTIME:
+      GST_OBJECT_LOCK (self);
+      self->realtime = g_value_get_boolean (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static GstStructure *
+gst_mpp_video_enc_get_stats (GstMppVideoEnc * self)
+{
+  GstStructure *s;
+
+  GST_OBJECT_LOCK (self);
+  s = gst_structure_new ("GstMppVideoEncStats",
+      "frames", G_TYPE_UINT64, self->stats_frames,
+      "dropped-frames", G_TYPE_UINT64, self->stats_dropped,
+      "intra-frames", G_TYPE_UINT64, self->stats_intra_frames,
+      "bytes", G_TYPE_UINT64, self->stats_bytes,
+      "average-qp", G_TYPE_DOUBLE, self->stats_qp_frames ?
+      (gdouble) self->stats_qp_sum / self->stats_qp_frames : -1.0,
+      "average-encode-time", G_TYPE_UINT64, self->stats_frames ?
+      self->stats_encode_time / self->stats_frames : (guint64) 0,
+      "max-encode-time", G_TYPE_UINT64, self->stats_max_encode_time, NULL);
+  GST_OBJECT_UNLOCK (self);
+
+  return s;
+}
+
+/* Account for a frame coming out of the encoder */
+static void
+gst_mpp_video_enc_update_stats (GstMppVideoEnc * self,
+    GstMppEncStatsMeta * meta)
+{
+  GST_OBJECT_LOCK (self);
+  self->stats_frames++;
+  if (meta->intra)
+    self->stats_intra_frames++;
+  self->stats_bytes += meta->size;
+  if (meta->avg_qp >= 0) {
+    self->stats_qp_sum += meta->avg_qp;
+    self->stats_qp_frames++;
+  }
+  self->stats_encode_time += meta->encode_time;
+  self->stats_max_encode_time = MAX (self->stats_max_encode_time,
+      meta->encode_time);
+  GST_OBJECT_UNLOCK (self);
+}
+
+static void
+gst_mpp_video_enc_get_property (GObject * object,
+    guint prop_id, GValue * value, GParamSpec * pspec)
+{
+  GstMppVideoEnc *self = GST_MPP_VIDEO_ENC (object);
+
+  switch (prop_id) {
+    case PROP_MAX_PENDING:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint (value, self->max_pending);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_SLICE_MODE:
+      GST_OBJECT_LOCK (self);
+      g_value_set_enum (value, self->slice_mode);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_SLICE_SIZE:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint (value, self->slice_size);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_ROI_QP_DELTA:
+      GST_OBJECT_LOCK (self);
+      g_value_set_int (value, self->roi_qp_delta);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_BG_QP_DELTA:
+      GST_OBJECT_LOCK (self);
+      g_value_set_int (value, self->bg_qp_delta);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_REALTIME:
+      GST_OBJECT_LOCK (self);
+      g_value_set_boolean (value, self->realtime);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_STATS:
+      g_value_take_boxed (value, gst_mpp_video_enc_get_stats (self));
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+/* Largest frame the encoder of @coding takes on this SoC, looked up once
+ * from the device tree */
+void
+gst_mpp_video_enc_get_max_size (MppCodingType coding, gint * max_width,
+    gint * max_height)
+{
+  static gsize probed = 0;
+  static gint soc_max_width = MPP_ENC_DEFAULT_MAX_WIDTH;
+  static gint soc_max_height = MPP_ENC_DEFAULT_MAX_HEIGHT;
+
+  if (g_once_init_enter (&probed)) {
+    gchar *compatible = NULL, *p;
+    gsize len = 0;
+    guint i;
+
+    if (g_file_get_contents ("/proc/device-tree/compatible", &compatible,
+            &len, NULL)) {
+      /* A list of NUL terminated strings */
+      for (p = compatible; p < compatible + len; p += strlen (p) + 1) {
+        for (i = 0; i < G_N_ELEMENTS (gst_mpp_video_enc_socs); i++) {
+          if (g_str_equal (p, gst_mpp_video_enc_socs[i].compatible)) {
+            soc_max_width = gst_mpp_video_enc_socs[i].max_width;
+            soc_max_height = gst_mpp_video_enc_socs[i].max_height;
+          }
+        }
+      }
+      g_free (compatible);
+    }
+
+    GST_INFO ("video encoder limited to %dx%d", soc_max_width,
+        soc_max_height);
+    g_once_init_leave (&probed, 1);
+  }
+
+  if (coding == MPP_VIDEO_CodingMJPEG) {
+    *max_width = MPP_JPEG_ENC_MAX_SIZE;
+    *max_height = MPP_JPEG_ENC_MAX_SIZE;
+  } else {
+    *max_width = soc_max_width;
+    *max_height = soc_max_height;
+  }
+}
+
+/* Add the pad templates of an encoder of @coding, @src_caps gets the size
+ * limits unless it has its own */
+void
+gst_mpp_video_enc_add_pad_templates (GstElementClass * element_class,
+    MppCodingType coding, GstCaps * src_caps)
+{
+  GstStructure *structure;
+  GstCaps *sink_caps;
+  gint max_width, max_height;
+  guint i;
+
+  gst_mpp_video_enc_get_max_size (coding, &max_width, &max_height);
+
+  sink_caps = gst_caps_from_string ("video/x-raw, "
+      "format = (string) { NV12, I420, YUY2, UYVY, NV21, NV16, "
+      "BGRx, BGRA, RGBx, RGBA, xRGB, ARGB, xBGR, ABGR, RGB, BGR }, "
+      "framerate = (fraction) [0/1, 60/1]");
+  gst_caps_set_simple (sink_caps,
+      "width", GST_TYPE_INT_RANGE, 32, max_width,
+      "height", GST_TYPE_INT_RANGE, 32, max_height, NULL);
+
+  for (i = 0; i < gst_caps_get_size (src_caps); i++) {
+    structure = gst_caps_get_structure (src_caps, i);
+    if (!gst_structure_has_field (structure, "width"))
+      gst_structure_set (structure,
+          "width", GST_TYPE_INT_RANGE, 32, max_width,
+          "height", GST_TYPE_INT_RANGE, 32, max_height, NULL);
+  }
+
+  gst_element_class_add_pad_template (element_class,
+      gst_pad_template_new ("sink", GST_PAD_SINK, GST_PAD_ALWAYS, sink_caps));
+  gst_element_class_add_pad_template (element_class,
+      gst_pad_template_new ("src", GST_PAD_SRC, GST_PAD_ALWAYS, src_caps));
+
+  gst_caps_unref (sink_caps);
+  gst_caps_unref (src_caps);
+}
+
+GType
+gst_mpp_enc_rc_mode_get_type (void)
+{
+  static GType mpp_enc_rc_mode = 0;
+
+  if (!mpp_enc_rc_mode) {
+    static const GEnumValue rc_modes[] = {
+      {GST_MPP_ENC_RC_MODE_CBR, "GST_MPP_ENC_RC_MODE_CBR", "cbr"},
+      {GST_MPP_ENC_RC_MODE_VBR, "GST_MPP_ENC_RC_MODE_VBR", "vbr"},
+      {GST_MPP_ENC_RC_MODE_CQP, "GST_MPP_ENC_RC_MODE_CQP", "cqp"},
+      {GST_MPP_ENC_RC_MODE_AVBR, "GST_MPP_ENC_RC_MODE_AVBR", "avbr"},
+      {0, NULL, NULL}
+    };
+    mpp_enc_rc_mode = g_enum_register_static ("GstMppEncRcMode", rc_modes);
+  }
+  return mpp_enc_rc_mode;
+}
+
+GType
+gst_mpp_enc_slice_mode_get_type (void)
+{
+  static GType mpp_enc_slice_mode = 0;
+
+  if (!mpp_enc_slice_mode) {
+    static const GEnumValue slice_modes[] = {
+      {GST_MPP_ENC_SLICE_MODE_NONE, "GST_MPP_ENC_SLICE_MODE_NONE", "none"},
+      {GST_MPP_ENC_SLICE_MODE_BYTES, "GST_MPP_ENC_SLICE_MODE_BYTES", "bytes"},
+      {GST_MPP_ENC_SLICE_MODE_MB_ROWS, "GST_MPP_ENC_SLICE_MODE_MB_ROWS",
+          "mb-rows"},
+      {0, NULL, NULL}
+    };
+    mpp_enc_slice_mode =
+        g_enum_register_static ("GstMppEncSliceMode", slice_modes);
+  }
+  return mpp_enc_slice_mode;
+}
+
+void
+gst_mpp_video_enc_install_rc_properties (GObjectClass * gobject_class)
+{
+  g_object_class_install_property (gobject_class, PROP_RC_MODE,
+      g_param_spec_enum ("rc-mode", "RC mode", "Rate control mode",
+          GST_TYPE_MPP_ENC_RC_MODE, DEFAULT_PROP_RC_MODE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING));
+
+  g_object_class_install_property (gobject_class, PROP_BITRATE,
+      g_param_spec_uint ("bitrate", "Bitrate",
+          "Target bitrate in bits per second (0 = from the resolution)",
+          0, G_MAXINT, DEFAULT_PROP_BITRATE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_BITRATE,
+      g_param_spec_uint ("max-bitrate", "Max bitrate",
+          "Peak bitrate in bits per second (0 = 17/16 of the bitrate)",
+          0, G_MAXINT, DEFAULT_PROP_MAX_BITRATE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING));
+
+  g_object_class_install_property (gobject_class, PROP_GOP,
+      g_param_spec_uint ("gop", "GOP",
+          "Distance between two intra frames (0 = one second)",
+          0, G_MAXINT, DEFAULT_PROP_GOP,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING));
+
+  g_object_class_install_property (gobject_class, PROP_QP_INIT,
+      g_param_spec_int ("qp-init", "Initial QP",
+          "QP of the first frame, of every frame in cqp (-1 = automatic)",
+          -1, 51, DEFAULT_PROP_QP,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING));
+
+  g_object_class_install_property (gobject_class, PROP_QP_MIN,
+      g_param_spec_int ("qp-min", "Min QP", "Minimum QP (-1 = automatic)",
+          -1, 51, DEFAULT_PROP_QP,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING));
+
+  g_object_class_install_property (gobject_class, PROP_QP_MAX,
+      g_param_spec_int ("qp-max", "Max QP", "Maximum QP (-1 = automatic)",
+          -1, 51, DEFAULT_PROP_QP,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING));
+
+  g_object_class_install_property (gobject_class, PROP_VI_INTERVAL,
+      g_param_spec_uint ("vi-interval", "Virtual intra interval",
+          "Smart P: distance between the virtual intra frames, P frames "
+          "only referring to the last IDR kept as long-term reference. "
+          "The gop then defaults to 10 seconds (0 = disabled)",
+          0, G_MAXINT, DEFAULT_PROP_VI_INTERVAL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+}
+
+gboolean
+gst_mpp_video_enc_rc_set_property (GstMppVideoEnc * self,
+    guint prop_id, const GValue * value, GParamSpec * pspec)
+{
+  GST_OBJECT_LOCK (self);
+  switch (prop_id) {
+    case PROP_RC_MODE:
+      self->rc_mode = g_value_get_enum (value);
+      break;
+    case PROP_BITRATE:
+      self->bitrate = g_value_get_uint (value);
+      break;
+    case PROP_MAX_BITRATE:
+      self->max_bitrate = g_value_get_uint (value);
+      break;
+    case PROP_GOP:
+      self->gop = g_value_get_uint (value);
+      break;
+    case PROP_QP_INIT:
+      self->qp_init = g_value_get_int (value);
+      break;
+    case PROP_QP_MIN:
+      self->qp_min = g_value_get_int (value);
+      break;
+    case PROP_QP_MAX:
+      self->qp_max = g_value_get_int (value);
+      break;
+    case PROP_VI_INTERVAL:
+      self->vi_interval = g_value_get_uint (value);
+      break;
+    default:
+      GST_OBJECT_UNLOCK (self);
+      return FALSE;
+  }
+  self->rc_dirty = TRUE;
+  GST_OBJECT_UNLOCK (self);
+
+  return TRUE;
+}
+
+gboolean
+gst_mpp_video_enc_rc_get_property (GstMppVideoEnc * self,
+    guint prop_id, GValue * value, GParamSpec * pspec)
+{
+  GST_OBJECT_LOCK (self);
+  switch (prop_id) {
+    case PROP_RC_MODE:
+      g_value_set_enum (value, self->rc_mode);
+      break;
+    case PROP_BITRATE:
+      g_value_set_uint (value, self->bitrate);
+      break;
+    case PROP_MAX_BITRATE:
+      g_value_set_uint (value, self->max_bitrate);
+      break;
+    case PROP_GOP:
+      g_value_set_uint (value, self->gop);
+      break;
+    case PROP_QP_INIT:
+      g_value_set_int (value, self->qp_init);
+      break;
+    case PROP_QP_MIN:
+      g_value_set_int (value, self->qp_min);
+      break;
+    case PROP_QP_MAX:
+      g_value_set_int (value, self->qp_max);
+      break;
+    case PROP_VI_INTERVAL:
+      g_value_set_uint (value, self->vi_interval);
+      break;
+    default:
+      GST_OBJECT_UNLOCK (self);
+      return FALSE;
+  }
+  GST_OBJECT_UNLOCK (self);
+
+  return TRUE;
+}
+
+#ifdef HAVE_MPP_ENC_REF_CFG
+/* Smart P: the frames refer to the previous one, and every vi_interval
+ * frames to the last IDR kept as long-term reference. Those virtual intra
+ * frames give random access points at the cost of a P frame. MPP goes
+ * back to its default references without an interval.
+ * The same references as mpi_enc_gen_smart_gop_ref_cfg() in MPP, all on
+ * temporal layer 0 with the long-term frame renewed every gop frames. */
+static gboolean
+gst_mpp_video_enc_set_ref_cfg (GstMppVideoEnc * self, guint vi_interval,
+    guint gop)
+{
+  MppEncRefLtFrmCfg lt_ref;
+  MppEncRefStFrmCfg st_ref[3];
+  MppEncRefCfg ref = NULL;
+  gint pos = 0;
+  gboolean ret = TRUE;
+
+  if (vi_interval) {
+    if (mpp_enc_ref_cfg_init (&ref))
+      return FALSE;
+
+    memset (&lt_ref, 0, sizeof (lt_ref));
+    memset (st_ref, 0, sizeof (st_ref));
+
+    lt_ref.lt_idx = 0;
+    lt_ref.temporal_id = 0;
+    lt_ref.ref_mode = REF_TO_PREV_LT_REF;
+    lt_ref.lt_gap = gop;
+    lt_ref.lt_delay = 0;
+
+    /* The virtual intra frame */
+    st_ref[pos].is_non_ref = 0;
+    st_ref[pos].temporal_id = 0;
+    st_ref[pos].ref_mode = REF_TO_PREV_INTRA;
+    st_ref[pos].repeat = 0;
+    pos++;
+
+    /* The P frames up to the next one */
+    if (vi_interval > 1) {
+      st_ref[pos].is_non_ref = 0;
+      st_ref[pos].temporal_id = 0;
+      st_ref[pos].ref_mode = REF_TO_PREV_REF_FRM;
+      st_ref[pos].repeat = vi_interval - 2;
+      pos++;
+    }
+
+    /* Where the cycle starts again */
+    st_ref[pos].is_non_ref = 0;
+    st_ref[pos].temporal_id = 0;
+    st_ref[pos].ref_mode = REF_TO_PREV_INTRA;
+    st_ref[pos].repeat = 0;
+    pos++;
+
+    if (mpp_enc_ref_cfg_set_cfg_cnt (ref, 1, pos)
+        || mpp_enc_ref_cfg_add_lt_cfg (ref, 1, &lt_ref)
+        || mpp_enc_ref_cfg_add_st_cfg (ref, pos, st_ref)
+        || mpp_enc_ref_cfg_check (ref))
+      ret = FALSE;
+  }
+
+  if (ret && self->mpi->control (self->mpp_ctx, MPP_ENC_SET_REF_CFG, ref))
+    ret = FALSE;
+
+  if (ref)
+    mpp_enc_ref_cfg_deinit (&ref);
+
+  if (!ret) {
+    GST_DEBUG_OBJECT (self, "Setting the references for rockchip mpp failed");
+    return FALSE;
+  }
+
+  GST_DEBUG_OBJECT (self, "Virtual intra frames every %u frames, gop %u",
+      vi_interval, gop);
+  self->ref_vi_interval = vi_interval;
+  self->ref_gop = gop;
+
+  return TRUE;
+}
+#endif
+
+/* Push the rate control properties to MPP, fine while encoding. The QP
+ * limits are left to the codec configuration of the caller */
+gboolean
+gst_mpp_video_enc_set_rc_cfg (GstMppVideoEnc * self, GstVideoInfo * info,
+    GstMppVideoEncQp * qp)
+{
+  MppEncRcCfg rc_cfg;
+  GstMppEncRcMode rc_mode;
+  guint bitrate, max_bitrate, gop, fps;
+  gint qp_init, qp_min, qp_max;
+  gboolean idr_on_request;
+  guint vi_interval;
+
+  GST_OBJECT_LOCK (self);
+  rc_mode = self->rc_mode;
+  bitrate = self->bitrate;
+  max_bitrate = self->max_bitrate;
+  gop = self->gop;
+  qp_init = self->qp_init;
+  qp_min = self->qp_min;
+  qp_max = self->qp_max;
+  idr_on_request = self->idr_on_request;
+  vi_interval = self->vi_interval;
+  self->rc_dirty = FALSE;
+  GST_OBJECT_UNLOCK (self);
+
+#ifndef HAVE_MPP_ENC_REF_CFG
+  if (vi_interval)
+    GST_WARNING_OBJECT (self, "MPP is too old for Smart P, ignoring the "
+        "vi-interval");
+  vi_interval = 0;
+#endif
+
+  memset (&rc_cfg, 0, sizeof (rc_cfg));
+
+  fps = GST_VIDEO_INFO_FPS_D (info) ?
+      GST_VIDEO_INFO_FPS_N (info) / GST_VIDEO_INFO_FPS_D (info) : 0;
+
+  rc_cfg.change = MPP_ENC_RC_CFG_CHANGE_ALL;
+  rc_cfg.quality = MPP_ENC_RC_QUALITY_MEDIUM;
+
+  rc_cfg.fps_in_flex = 0;
+  rc_cfg.fps_in_num = GST_VIDEO_INFO_FPS_N (info);
+  rc_cfg.fps_in_denorm = GST_VIDEO_INFO_FPS_D (info);
+  rc_cfg.fps_out_flex = 0;
+  rc_cfg.fps_out_num = GST_VIDEO_INFO_FPS_N (info);
+  rc_cfg.fps_out_denorm = GST_VIDEO_INFO_FPS_D (info);
+  /* A gop of 0 only makes the first frame an IDR */
+  if (idr_on_request)
+    rc_cfg.gop = 0;
+  else if (vi_interval)
+    rc_cfg.gop = gop ? gop : fps * MPP_ENC_SMART_P_GOP_SECONDS;
+  else
+    rc_cfg.gop = gop ? gop : fps;
+  rc_cfg.skip_cnt = 0;
+
+  /* Bits of a second */
+  rc_cfg.bps_target = bitrate ? bitrate : GST_VIDEO_INFO_WIDTH (info)
+      * GST_VIDEO_INFO_HEIGHT (info) / 8 * fps;
+  rc_cfg.bps_max = max_bitrate ? max_bitrate : rc_cfg.bps_target * 17 / 16;
+
+  switch (rc_mode) {
+    case GST_MPP_ENC_RC_MODE_CBR:
+      rc_cfg.rc_mode = MPP_ENC_RC_MODE_CBR;
+      rc_cfg.bps_min = rc_cfg.bps_target * 15 / 16;
+      qp->init = 26;
+      qp->max = 28;
+      qp->min = 4;
+      qp->max_step = 8;
+      break;
+    case GST_MPP_ENC_RC_MODE_VBR:
+    case GST_MPP_ENC_RC_MODE_AVBR:
+      /* MPP has no average VBR, cap the peaks at the target instead */
+      rc_cfg.rc_mode = MPP_ENC_RC_MODE_VBR;
+      if (rc_mode == GST_MPP_ENC_RC_MODE_AVBR)
+        rc_cfg.bps_max = rc_cfg.bps_target;
+      rc_cfg.bps_min = rc_cfg.bps_target * 1 / 16;
+      qp->init = 0;
+      qp->max = 40;
+      qp->min = 12;
+      qp->max_step = 0;
+      break;
+    case GST_MPP_ENC_RC_MODE_CQP:
+      rc_cfg.rc_mode = MPP_ENC_RC_MODE_VBR;
+      rc_cfg.quality = MPP_ENC_RC_QUALITY_CQP;
+      rc_cfg.bps_target = -1;
+      rc_cfg.bps_max = -1;
+      rc_cfg.bps_min = -1;
+      if (qp_init < 0)
+        qp_init = 26;
+      qp->init = qp_init;
+      qp->max = qp_init;
+      qp->min = qp_init;
+      qp->max_step = 0;
+      break;
+  }
+
+  if (qp_init >= 0)
+    qp->init = qp_init;
+  if (rc_mode != GST_MPP_ENC_RC_MODE_CQP) {
+    if (qp_min >= 0)
+      qp->min = qp_min;
+    if (qp_max >= 0)
+      qp->max = qp_max;
+  }
+
+  GST_DEBUG_OBJECT (self, "rc mode %d, %d bps (max %d), gop %d, qp %d [%d, %d]",
+      rc_mode, rc_cfg.bps_target, rc_cfg.bps_max, rc_cfg.gop, qp->init,
+      qp->min, qp->max);
+
+  if (self->mpi->control (self->mpp_ctx, MPP_ENC_SET_RC_CFG, &rc_cfg)) {
+    GST_DEBUG_OBJECT (self, "Setting rate control for rockchip mpp failed");
+    return FALSE;
+  }
+
+#ifdef HAVE_MPP_ENC_REF_CFG
+  if ((vi_interval != self->ref_vi_interval
+          || (vi_interval && rc_cfg.gop != self->ref_gop))
+      && !gst_mpp_video_enc_set_ref_cfg (self, vi_interval, rc_cfg.gop))
+    return FALSE;
+#endif
+
+  return TRUE;
+}
+
+/* Wake up the threads waiting for a slot or for the output */
+static void
+gst_mpp_video_enc_unlock (GstMppVideoEnc * self)
+{
+  g_mutex_lock (&self->lock);
+  self->flushing = TRUE;
+  g_cond_broadcast (&self->cond);
+  g_mutex_unlock (&self->lock);
+}
+
+static void
+gst_mpp_video_enc_unlock_stop (GstMppVideoEnc * self)
+{
+  g_mutex_lock (&self->lock);
+  self->flushing = FALSE;
+  g_mutex_unlock (&self->lock);
+}
+
+typedef struct
+{
+  MppBuffer mpp_buf;
+  dev_t dev;
+  ino_t ino;
+} GstMppVideoEncImport;
+
+static void
+gst_mpp_video_enc_import_free (GstMppVideoEncImport * import)
+{
+  mpp_buffer_put (import->mpp_buf);
+  g_slice_free (GstMppVideoEncImport, import);
+}
+
+static void
+gst_mpp_video_enc_slot_release (GstMppVideoEncSlot * slot)
+{
+  if (slot->packet)
+    mpp_packet_deinit (&slot->packet);
+  if (slot->import_buffer) {
+    mpp_buffer_put (slot->import_buffer);
+    slot->import_buffer = NULL;
+  }
+  if (slot->output_buffer) {
+    mpp_buffer_put (slot->output_buffer);
+    slot->output_buffer = NULL;
+  }
+  gst_buffer_replace (&slot->inbuf, NULL);
+  slot->force_idr = FALSE;
+}
+
+/* Forget the frames in flight, the output task must be stopped */
+static void
+gst_mpp_video_enc_release_slots (GstMppVideoEnc * self)
+{
+  guint i;
+
+  for (i = 0; i < MPP_MAX_BUFFERS; i++)
+    gst_mpp_video_enc_slot_release (&self->slots[i]);
+
+  self->head = 0;
+  self->pending = 0;
+}
 
 static gboolean
 gst_mpp_video_enc_close (GstVideoEncoder * encoder)
 {
   GstMppVideoEnc *self = GST_MPP_VIDEO_ENC (encoder);
 
-  if (self->mpp_ctx)
+  if (self->mpp_ctx) {
     mpp_destroy (self->mpp_ctx);
+    self->mpp_ctx = NULL;
+    self->mpi = NULL;
+  }
+  self->low_delay = FALSE;
+  self->io_started = FALSE;
 
   return TRUE;
 }
@@ -77,27 +788,34 @@ gst_mpp_video_enc_start (GstVideoEncoder * encoder)
   GstMppVideoEnc *self = GST_MPP_VIDEO_ENC (encoder);
 
   GST_DEBUG_OBJECT (self, "Starting");
+  gst_mpp_video_enc_unlock_stop (self);
   g_atomic_int_set (&self->active, TRUE);
   self->output_flow = GST_FLOW_OK;
   self->outcaps = NULL;
+  self->length_prefixed = FALSE;
+  self->nal_aligned = FALSE;
+  self->head = 0;
+  self->pending = 0;
+  self->last_output_time = 0;
+  self->refresh_count = 0;
+  /* MPP may have been reset, configure the references again */
+  self->ref_vi_interval = 0;
+  self->ref_gop = 0;
+
+  GST_OBJECT_LOCK (self);
+  self->stats_frames = 0;
+  self->stats_dropped = 0;
+  self->stats_intra_frames = 0;
+  self->stats_bytes = 0;
+  self->stats_qp_sum = 0;
+  self->stats_qp_frames = 0;
+  self->stats_encode_time = 0;
+  self->stats_max_encode_time = 0;
+  GST_OBJECT_UNLOCK (self);
 
   return TRUE;
 }
 
-static void
-gst_mpp_video_enc_process_buffer_stopped (GstMppVideoEnc * self)
-{
-  if (g_atomic_int_get (&self->processing)) {
-    GST_DEBUG_OBJECT (self, "Early stop of encoding thread");
-    self->output_flow = GST_FLOW_FLUSHING;
-    g_atomic_int_set (&self->processing, FALSE);
-  }
-
-  GST_DEBUG_OBJECT (self, "Encoding task destroyed: %s",
-      gst_flow_get_name (self->output_flow));
-}
-
-
 static gboolean
 gst_mpp_video_enc_stop (GstVideoEncoder * encoder)
 {
@@ -106,17 +824,34 @@ gst_mpp_video_enc_stop (GstVideoEncoder * encoder)
 
   GST_DEBUG_OBJECT (self, "Stopping");
 
-  gst_mpp_video_enc_process_buffer_stopped (self);
+  /* Wait for the output thread to stop */
+  gst_mpp_video_enc_unlock (self);
+  gst_pad_stop_task (encoder->srcpad);
 
   GST_VIDEO_ENCODER_STREAM_LOCK (encoder);
   self->output_flow = GST_FLOW_OK;
   GST_VIDEO_ENCODER_STREAM_UNLOCK (encoder);
 
   g_assert (g_atomic_int_get (&self->active) == FALSE);
-  g_assert (g_atomic_int_get (&self->processing) == FALSE);
 
-  if (self->outcaps)
+  if (self->mpp_ctx)
+    self->mpi->reset (self->mpp_ctx);
+  gst_mpp_video_enc_release_slots (self);
+
+  if (self->outcaps) {
     gst_caps_unref (self->outcaps);
+    self->outcaps = NULL;
+  }
+
+  if (self->header_mem) {
+    gst_memory_unref (self->header_mem);
+    self->header_mem = NULL;
+  }
+
+  if (self->refresh_mem) {
+    gst_memory_unref (self->refresh_mem);
+    self->refresh_mem = NULL;
+  }
 
   if (self->input_state) {
     gst_video_codec_state_unref (self->input_state);
@@ -124,19 +859,18 @@ gst_mpp_video_enc_stop (GstVideoEncoder * encoder)
   }
 
   for (i = 0; i < MPP_MAX_BUFFERS; i++) {
-    if (self->input_buffer[i]) {
-      mpp_buffer_put (self->input_buffer[i]);
-      self->input_buffer[i] = NULL;
-    }
-    if (self->output_buffer[i]) {
-      mpp_buffer_put (self->output_buffer[i]);
-      self->output_buffer[i] = NULL;
+    GstMppVideoEncSlot *slot = &self->slots[i];
+
+    /* Must be destroy before input_group */
+    if (slot->mpp_frame)
+      mpp_frame_deinit (&slot->mpp_frame);
+
+    if (slot->input_buffer) {
+      mpp_buffer_put (slot->input_buffer);
+      slot->input_buffer = NULL;
     }
   }
-
-  /* Must be destroy before input_group */
-  if (self->mpp_frame)
-    mpp_frame_deinit (&self->mpp_frame);
+  self->input_size = 0;
 
   if (self->input_group) {
     mpp_buffer_group_put (self->input_group);
@@ -148,6 +882,15 @@ gst_mpp_video_enc_stop (GstVideoEncoder * encoder)
     self->output_group = NULL;
   }
 
+  /* Upstream may still hold it, the buffers are freed along with it */
+  gst_mpp_object_close_pool (self->mpp_input);
+
+  g_hash_table_remove_all (self->import_cache);
+  if (self->import_group) {
+    mpp_buffer_group_put (self->import_group);
+    self->import_group = NULL;
+  }
+
   GST_DEBUG_OBJECT (self, "Stopped");
 
   return TRUE;
@@ -176,6 +919,35 @@ to_mpp_pixel (GstCaps * caps, GstVideoInfo * info)
       case GST_VIDEO_FORMAT_UYVY:
         return MPP_FMT_YUV422_UYVY;
         break;
+      case GST_VIDEO_FORMAT_NV21:
+        return MPP_FMT_YUV420SP_VU;
+        break;
+      case GST_VIDEO_FORMAT_NV16:
+        return MPP_FMT_YUV422SP;
+        break;
+        /* MPP names the RGB formats after the 32 bits words */
+      case GST_VIDEO_FORMAT_BGRx:
+      case GST_VIDEO_FORMAT_BGRA:
+        return MPP_FMT_ARGB8888;
+        break;
+      case GST_VIDEO_FORMAT_RGBx:
+      case GST_VIDEO_FORMAT_RGBA:
+        return MPP_FMT_ABGR8888;
+        break;
+      case GST_VIDEO_FORMAT_xRGB:
+      case GST_VIDEO_FORMAT_ARGB:
+        return MPP_FMT_BGRA8888;
+        break;
+      case GST_VIDEO_FORMAT_xBGR:
+      case GST_VIDEO_FORMAT_ABGR:
+        return MPP_FMT_RGBA8888;
+        break;
+      case GST_VIDEO_FORMAT_RGB:
+        return MPP_FMT_BGR888;
+        break;
+      case GST_VIDEO_FORMAT_BGR:
+        return MPP_FMT_RGB888;
+        break;
       default:
         break;
     }
@@ -192,256 +964,1372 @@ gst_mpp_video_enc_set_format (GstVideoEncoder * encoder,
   gsize ver_stride, cr_h;
   GstVideoFormat format;
   MppEncPrepCfg prep_cfg;
+  gboolean renegotiating = FALSE;
+
+  GST_DEBUG_OBJECT (self, "Setting format: %" GST_PTR_FORMAT, state->caps);
+
+  if (self->input_state) {
+    if (gst_caps_is_strictly_equal (self->input_state->caps, state->caps)) {
+      GST_DEBUG_OBJECT (self, "Compatible caps");
+      goto done;
+    }
+
+    /* The subclass drained the frames in flight before reconfiguring MPP.
+     * The next frame negotiates the output again with the new headers, the
+     * slots grow when the frames no longer fit in them */
+    GST_DEBUG_OBJECT (self, "Renegotiating");
+    renegotiating = TRUE;
+    gst_video_codec_state_unref (self->input_state);
+    self->input_state = NULL;
+    if (self->outcaps) {
+      gst_caps_unref (self->outcaps);
+      self->outcaps = NULL;
+    }
+  }
+
+  format = state->info.finfo->format;
+
+  info = &self->info;
+  gst_video_info_init (info);
+  gst_video_info_set_format (info, format, GST_VIDEO_INFO_WIDTH (&state->info),
+      GST_VIDEO_INFO_HEIGHT (&state->info));
+
+  switch (info->finfo->format) {
+    case GST_VIDEO_FORMAT_NV12:
+    case GST_VIDEO_FORMAT_NV21:
+    case GST_VIDEO_FORMAT_I420:
+      ver_stride = GST_ROUND_UP_16 (GST_VIDEO_INFO_HEIGHT (info));
+      info->offset[0] = 0;
+      info->offset[1] = info->stride[0] * ver_stride;
+      cr_h = GST_ROUND_UP_2 (ver_stride) / 2;
+      if (GST_VIDEO_INFO_N_PLANES (info) > 2) {
+        info->offset[2] = info->offset[1] + info->stride[1] * cr_h;
+        info->size = info->offset[2] + info->stride[2] * cr_h;
+      } else {
+        info->size = info->offset[1] + info->stride[1] * cr_h;
+      }
+      break;
+    case GST_VIDEO_FORMAT_NV16:
+      ver_stride = GST_ROUND_UP_16 (GST_VIDEO_INFO_HEIGHT (info));
+      info->offset[0] = 0;
+      info->offset[1] = info->stride[0] * ver_stride;
+      info->size = info->offset[1] + info->stride[1] * ver_stride;
+      break;
+    case GST_VIDEO_FORMAT_YUY2:
+    case GST_VIDEO_FORMAT_UYVY:
+    case GST_VIDEO_FORMAT_BGRx:
+    case GST_VIDEO_FORMAT_BGRA:
+    case GST_VIDEO_FORMAT_RGBx:
+    case GST_VIDEO_FORMAT_RGBA:
+    case GST_VIDEO_FORMAT_xRGB:
+    case GST_VIDEO_FORMAT_ARGB:
+    case GST_VIDEO_FORMAT_xBGR:
+    case GST_VIDEO_FORMAT_ABGR:
+    case GST_VIDEO_FORMAT_RGB:
+    case GST_VIDEO_FORMAT_BGR:
+      ver_stride = GST_ROUND_UP_16 (GST_VIDEO_INFO_HEIGHT (info));
+      cr_h = GST_ROUND_UP_2 (ver_stride);
+      info->size = info->stride[0] * cr_h;
+      break;
+    default:
+      g_assert_not_reached ();
+      return FALSE;
+  }
+
+  /* Frames which have to be copied are converted to NV12 on the way when
+   * that shrinks them. YUY2 loses a quarter of its bytes, I420 would be
+   * as large and MPP converts the RGB formats itself. */
+  self->convert = NULL;
+  if (format == GST_VIDEO_FORMAT_YUY2)
+    self->convert = gst_mpp_convert_get_func (format);
+  self->copy_info = *info;
+  if (self->convert) {
+    GstVideoInfo *copy_info = &self->copy_info;
+
+    gst_video_info_set_format (copy_info, GST_VIDEO_FORMAT_NV12,
+        GST_VIDEO_INFO_WIDTH (info), GST_VIDEO_INFO_HEIGHT (info));
+    copy_info->offset[1] = copy_info->stride[0] * ver_stride;
+    copy_info->size = copy_info->offset[1]
+        + copy_info->stride[0] * GST_ROUND_UP_2 (ver_stride) / 2;
+  }
+
+  memset (&prep_cfg, 0, sizeof (prep_cfg));
+  prep_cfg.change = MPP_ENC_PREP_CFG_CHANGE_INPUT |
+      MPP_ENC_PREP_CFG_CHANGE_FORMAT;
+  prep_cfg.width = GST_VIDEO_INFO_WIDTH (&state->info);
+  prep_cfg.height = GST_VIDEO_INFO_HEIGHT (&state->info);
+  prep_cfg.format = to_mpp_pixel (state->caps, &self->copy_info);
+  prep_cfg.hor_stride = self->copy_info.stride[0];
+  prep_cfg.ver_stride = ver_stride;
+
+  if (self->mpi->control (self->mpp_ctx, MPP_ENC_SET_PREP_CFG, &prep_cfg)) {
+    GST_DEBUG_OBJECT (self, "Setting input format for rockchip mpp failed");
+    return FALSE;
+  }
+  self->ver_stride = ver_stride;
+  self->prep_format = prep_cfg.format;
+  self->prep_hor_stride = prep_cfg.hor_stride;
+  self->prep_ver_stride = prep_cfg.ver_stride;
+
+  /* Until the first frame picks the interface of MPP */
+  if (!self->io_started)
+    self->low_delay = FALSE;
+
+#ifdef HAVE_MPP_ENC_SPLIT
+  if (self->slice_mode != GST_MPP_ENC_SLICE_MODE_NONE && self->slice_size) {
+    MppEncSliceSplit split;
+
+    memset (&split, 0, sizeof (split));
+    split.change = MPP_ENC_SPLIT_CFG_CHANGE_ALL;
+    if (self->slice_mode == GST_MPP_ENC_SLICE_MODE_BYTES) {
+      split.split_mode = MPP_ENC_SPLIT_BY_BYTE;
+      split.split_arg = self->slice_size;
+    } else {
+      split.split_mode = MPP_ENC_SPLIT_BY_CTU;
+      split.split_arg = self->slice_size
+          * (GST_ROUND_UP_16 (GST_VIDEO_INFO_WIDTH (&state->info)) / 16);
+    }
+
+#ifdef HAVE_MPP_ENC_SPLIT_OUT
+    if (!self->io_started)
+      self->low_delay = TRUE;
+    else if (!self->low_delay)
+      GST_WARNING_OBJECT (self, "Slices enabled after encoding started, "
+          "they only leave with their frame");
+    if (self->low_delay)
+      split.split_out = MPP_ENC_SPLIT_OUT_LOWDELAY;
+#endif
+
+    if (self->mpi->control (self->mpp_ctx, MPP_ENC_SET_SPLIT, &split)) {
+      GST_DEBUG_OBJECT (self, "Setting slice split for rockchip mpp failed");
+      return FALSE;
+    }
+  }
+#else
+  if (self->slice_mode != GST_MPP_ENC_SLICE_MODE_NONE && self->slice_size)
+    GST_WARNING_OBJECT (self, "MPP is too old to split the frames, encoding "
+        "a single slice");
+#endif
+
+  /* The stream starts again from an IDR carrying the new headers */
+  if (renegotiating
+      && self->mpi->control (self->mpp_ctx, MPP_ENC_SET_IDR_FRAME, NULL))
+    GST_WARNING_OBJECT (self, "failed to request an IDR frame");
+
+  if (self->mpi->control
+      (self->mpp_ctx, MPP_ENC_GET_EXTRA_INFO, &self->sps_packet))
+    self->sps_packet = NULL;
+
+  if (self->header_mem) {
+    gst_memory_unref (self->header_mem);
+    self->header_mem = NULL;
+  }
+
+  if (self->sps_packet) {
+    gsize sps_len = mpp_packet_get_length (self->sps_packet);
+    gpointer sps_data;
+
+    sps_data = g_memdup (mpp_packet_get_pos (self->sps_packet), sps_len);
+    self->header_mem = gst_memory_new_wrapped (GST_MEMORY_FLAG_READONLY,
+        sps_data, sps_len, 0, sps_len, sps_data, g_free);
+  }
+
+  self->input_state = gst_video_codec_state_ref (state);
+
+done:
+  return TRUE;
+}
+
+static gboolean
+gst_mpp_video_enc_flush (GstVideoEncoder * encoder)
+{
+  GstMppVideoEnc *self = GST_MPP_VIDEO_ENC (encoder);
+
+  GST_DEBUG_OBJECT (self, "Flushing");
+
+  /* Ensure the output thread has stopped before resetting mpp */
+  if (gst_pad_get_task_state (encoder->srcpad) == GST_TASK_STARTED) {
+    GST_VIDEO_ENCODER_STREAM_UNLOCK (encoder);
+    gst_mpp_video_enc_unlock (self);
+    gst_pad_stop_task (encoder->srcpad);
+    GST_VIDEO_ENCODER_STREAM_LOCK (encoder);
+  }
+  self->output_flow = GST_FLOW_OK;
+
+  self->mpi->reset (self->mpp_ctx);
+  gst_mpp_video_enc_release_slots (self);
+
+  gst_mpp_video_enc_unlock_stop (self);
+
+  return TRUE;
+}
+
+static void
+gst_mpp_video_enc_buffer_put (MppBuffer mpp_buf)
+{
+  mpp_buffer_put (mpp_buf);
+}
+
+/* Search the next start code from @offset, on success @offset and @nal_size
+ * point to the payload of the NAL, trailing zero bytes excluded */
+gboolean
+gst_mpp_video_enc_next_nal (const guint8 * data, gsize size, gsize * offset,
+    gsize * nal_size)
+{
+  gsize i, start, end;
+
+  for (i = *offset; i + 3 <= size; i++)
+    if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1)
+      break;
+  if (i + 3 > size)
+    return FALSE;
+
+  start = i + 3;
+  for (i = start; i + 3 <= size; i++)
+    if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1)
+      break;
+  end = i + 3 <= size ? i : size;
+  while (end > start && data[end - 1] == 0)
+    end--;
+
+  *offset = start;
+  *nal_size = end - start;
+
+  return TRUE;
+}
+
+/* Replace the start codes by the 4 bytes size of each NAL. It is done in
+ * place when no start code is shorter than 4 bytes, as MPP writes them,
+ * otherwise the result goes into a new memory */
+static GstMemory *
+gst_mpp_video_enc_to_length_prefixed (GstMppVideoEnc * self, guint8 * data,
+    gsize * size)
+{
+  GstMemory *mem = NULL;
+  GstMapInfo map;
+  gsize offset = 0, nal_size, out_size = 0;
+  gboolean in_place = TRUE;
+  guint8 *dst = data;
+
+  while (gst_mpp_video_enc_next_nal (data, *size, &offset, &nal_size)) {
+    if (out_size + 4 > offset)
+      in_place = FALSE;
+    out_size += 4 + nal_size;
+    offset += nal_size;
+  }
+
+  if (!in_place) {
+    GST_DEBUG_OBJECT (self, "Short start codes, converting into a copy");
+    mem = gst_allocator_alloc (NULL, out_size, NULL);
+    gst_memory_map (mem, &map, GST_MAP_WRITE);
+    dst = map.data;
+  }
+
+  offset = 0;
+  out_size = 0;
+  while (gst_mpp_video_enc_next_nal (data, *size, &offset, &nal_size)) {
+    memmove (dst + out_size + 4, data + offset, nal_size);
+    GST_WRITE_UINT32_BE (dst + out_size, nal_size);
+    out_size += 4 + nal_size;
+    offset += nal_size;
+  }
+
+  if (mem)
+    gst_memory_unmap (mem, &map);
+  *size = out_size;
+
+  return mem;
+}
+
+#ifdef GST_MPP_VIDEO_ENC_SUBFRAMES
+/* Cut a part of an access unit into one buffer per NAL, sharing its
+ * memories. The stream headers, the refresh NALs and the packets are
+ * separate memories, each starting on a NAL boundary */
+static GstBufferList *
+gst_mpp_video_enc_split_nals (GstMppVideoEnc * self, GstBuffer * buffer)
+{
+  GstBufferList *list = gst_buffer_list_new ();
+  GstMapInfo map;
+  gsize base = 0, start, offset, nal_size;
+  guint i;
+
+  for (i = 0; i < gst_buffer_n_memory (buffer); i++) {
+    GstMemory *mem = gst_buffer_peek_memory (buffer, i);
+
+    gst_memory_map (mem, &map, GST_MAP_READ);
+
+    start = 0;
+    offset = 0;
+    while (start < map.size) {
+      if (self->length_prefixed) {
+        if (start + 4 > map.size)
+          break;
+        nal_size = 4 + GST_READ_UINT32_BE (map.data + start);
+        offset = MIN (start + nal_size, map.size);
+      } else {
+        offset = start;
+        if (!gst_mpp_video_enc_next_nal (map.data, map.size, &offset,
+                &nal_size))
+          break;
+        offset += nal_size;
+        /* The next NAL starts with its start code */
+        while (offset < map.size && map.data[offset] != 1)
+          offset++;
+        if (offset < map.size)
+          offset -= 2;
+        if (offset > start + 3 && map.data[offset - 1] == 0)
+          offset--;
+      }
+
+      gst_buffer_list_add (list, gst_buffer_copy_region (buffer,
+              GST_BUFFER_COPY_MEMORY, base + start, offset - start));
+      start = offset;
+    }
+
+    base += map.size;
+    gst_memory_unmap (mem, &map);
+  }
+
+  return list;
+}
+#endif
+
+/* The stream headers go in front of intra frames and of the first frame
+ * of a refresh cycle */
+static void
+gst_mpp_video_enc_prepend_headers (GstMppVideoEnc * self, GstBuffer * buffer,
+    gboolean intra, gboolean refresh)
+{
+  if (refresh && self->refresh_mem)
+    gst_buffer_prepend_memory (buffer, gst_memory_ref (self->refresh_mem));
+
+  /* The headers already are in the codec_data of length prefixed streams */
+  if ((intra || refresh) && self->header_mem && !self->length_prefixed)
+    gst_buffer_prepend_memory (buffer, gst_memory_ref (self->header_mem));
+}
+
+/* Wrap the packet in place, the output buffer of the slot goes back to the
+ * output group once downstream drops the GstBuffer */
+static GstBuffer *
+gst_mpp_video_enc_packet_to_buffer (GstMppVideoEnc * self,
+    GstMppVideoEncSlot * slot, MppPacket packet)
+{
+  MppBuffer mpp_buf = slot->output_buffer;
+  GstBuffer *buffer;
+  GstMemory *mem = NULL;
+  gsize offset, len;
+
+  offset = (guint8 *) mpp_packet_get_pos (packet)
+      - (guint8 *) mpp_buffer_get_ptr (mpp_buf);
+  len = mpp_packet_get_length (packet);
+
+  GST_LOG_OBJECT (self, "Wrapping %" G_GSIZE_FORMAT " bytes packet", len);
+
+  if (self->length_prefixed)
+    mem = gst_mpp_video_enc_to_length_prefixed (self,
+        mpp_packet_get_pos (packet), &len);
+
+  if (mem) {
+    mpp_buffer_put (mpp_buf);
+  } else {
+    mem = gst_memory_new_wrapped (GST_MEMORY_FLAG_READONLY,
+        mpp_buffer_get_ptr (mpp_buf), mpp_buffer_get_size (mpp_buf), offset,
+        len, mpp_buf, (GDestroyNotify) gst_mpp_video_enc_buffer_put);
+  }
+  slot->output_buffer = NULL;
+
+  buffer = gst_buffer_new ();
+  gst_buffer_append_memory (buffer, mem);
+
+  return buffer;
+}
+
+/* Intra refresh cycles follow each other from the last IDR. Whatever the
+ * phase of MPP, a whole cycle of frames refreshes every row. Returns
+ * whether the frame starts a cycle */
+static gboolean
+gst_mpp_video_enc_count_refresh (GstMppVideoEnc * self, gint intra_flag)
+{
+  if (intra_flag) {
+    self->refresh_count = 0;
+  } else if (self->refresh_period
+      && ++self->refresh_count == self->refresh_period) {
+    self->refresh_count = 0;
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
+static void
+gst_mpp_video_enc_init_stats (GstMppVideoEnc * self, GstMppVideoEncSlot * slot,
+    MppPacket packet, gint intra_flag, GstMppEncStatsMeta * stats)
+{
+  gint64 now;
+
+  /* With several frames in flight the hardware only starts on this one
+   * once the previous one is out */
+  now = g_get_monotonic_time ();
+  stats->encode_time = (now - MAX (slot->submit_time,
+          self->last_output_time)) * GST_USECOND;
+  self->last_output_time = now;
+  stats->intra = intra_flag;
+  stats->avg_qp = -1;
+  stats->size = 0;
+#ifdef HAVE_MPP_ENC_AVERAGE_QP
+  if (packet && mpp_packet_has_meta (packet))
+    mpp_meta_get_s32 (mpp_packet_get_meta (packet), KEY_ENC_AVERAGE_QP,
+        &stats->avg_qp);
+#endif
+}
+
+/* The slot can be used for a new frame */
+static void
+gst_mpp_video_enc_slot_done (GstMppVideoEnc * self, GstMppVideoEncSlot * slot)
+{
+  gst_mpp_video_enc_slot_release (slot);
+
+  g_mutex_lock (&self->lock);
+  self->pending--;
+  g_cond_broadcast (&self->cond);
+  g_mutex_unlock (&self->lock);
+}
+
+/* Get the frame of @frame_number, a sync point when it is intra coded.
+ * finish_frame() and finish_subframe() set the DELTA_UNIT flag from it.
+ * The first frame of a refresh cycle stays a delta unit, its recovery
+ * point SEI tells the decoders that can start there */
+static GstVideoCodecFrame *
+gst_mpp_video_enc_get_frame (GstMppVideoEnc * self, guint32 frame_number,
+    gint intra_flag)
+{
+  GstVideoCodecFrame *frame;
+
+  frame = gst_video_encoder_get_frame (GST_VIDEO_ENCODER (self),
+      frame_number);
+  if (!frame) {
+    GST_WARNING_OBJECT (self, "Encoder is producing too many buffers");
+    return NULL;
+  }
+
+  if (intra_flag)
+    GST_VIDEO_CODEC_FRAME_SET_SYNC_POINT (frame);
+  else
+    GST_VIDEO_CODEC_FRAME_UNSET_SYNC_POINT (frame);
+
+  return frame;
+}
+
+/* Push @buffer, a part of @frame or the rest of it when @last. With
+ * alignment=nal each NAL is a buffer, going through finish_subframe() but
+ * for the last one of the frame, which finishes it along with the stats
+ * meta. Takes @buffer, and @frame when @last */
+static GstFlowReturn
+gst_mpp_video_enc_push_part (GstMppVideoEnc * self, GstVideoCodecFrame * frame,
+    GstBuffer * buffer, gboolean last, GstMppEncStatsMeta * stats)
+{
+  GstVideoEncoder *encoder = GST_VIDEO_ENCODER (self);
+  GstFlowReturn ret = GST_FLOW_OK, finish_ret;
+
+#ifdef GST_MPP_VIDEO_ENC_SUBFRAMES
+  if (self->nal_aligned) {
+    GstBufferList *nals = gst_mpp_video_enc_split_nals (self, buffer);
+    guint i, n = gst_buffer_list_length (nals);
+
+    if (n > 0)
+      gst_buffer_replace (&buffer, NULL);
+
+    for (i = 0; i < n; i++) {
+      GstBuffer *nal = gst_buffer_ref (gst_buffer_list_get (nals, i));
+
+      if (last && i == n - 1) {
+        buffer = nal;
+      } else if (ret == GST_FLOW_OK) {
+        frame->output_buffer = nal;
+        ret = gst_video_encoder_finish_subframe (encoder, frame);
+      } else {
+        gst_buffer_unref (nal);
+      }
+    }
+    gst_buffer_list_unref (nals);
+  }
+
+  if (!last) {
+    if (buffer && ret == GST_FLOW_OK) {
+      frame->output_buffer = buffer;
+      ret = gst_video_encoder_finish_subframe (encoder, frame);
+    } else if (buffer) {
+      gst_buffer_unref (buffer);
+    }
+    return ret;
+  }
+#else
+  g_assert (last);
+#endif
+
+  /* Once per frame, its size is only known at the end */
+  gst_buffer_add_mpp_enc_stats_meta (buffer, stats->avg_qp, stats->size,
+      stats->intra, stats->encode_time);
+  frame->output_buffer = buffer;
+  finish_ret = gst_video_encoder_finish_frame (encoder, frame);
+
+  return ret != GST_FLOW_OK ? ret : finish_ret;
+}
+
+/* Push the frame of @slot from its task, once it is encoded whole */
+static GstFlowReturn
+gst_mpp_video_enc_output_task (GstMppVideoEnc * self,
+    GstMppVideoEncSlot * slot)
+{
+  GstVideoCodecFrame *frame;
+  GstBuffer *buffer = NULL;
+  MppPacket packet = NULL;
+  MppTask task = NULL;
+  GstFlowReturn ret = GST_FLOW_OK;
+  GstMppEncStatsMeta stats;
+  guint32 frame_number;
+  gint intra_flag = 0;
+  gboolean refresh;
+
+  /* The hardware always completes the frames it was given */
+  if (self->mpi->poll (self->mpp_ctx, MPP_PORT_OUTPUT, MPP_POLL_BLOCK)
+      || self->mpi->dequeue (self->mpp_ctx, MPP_PORT_OUTPUT, &task)
+      || NULL == task) {
+    GST_ERROR_OBJECT (self, "mpp task output dequeue failed");
+    return GST_FLOW_ERROR;
+  }
+
+  mpp_task_meta_get_packet (task, KEY_OUTPUT_PACKET, &packet);
+  g_assert (packet == slot->packet);
+  mpp_task_meta_get_s32 (task, KEY_OUTPUT_INTRA, &intra_flag, 0);
+  if (slot->force_idr && !intra_flag)
+    GST_WARNING_OBJECT (self, "frame %u was forced as a keyframe but isn't "
+        "intra coded", slot->frame_number);
+
+  refresh = gst_mpp_video_enc_count_refresh (self, intra_flag);
+  gst_mpp_video_enc_init_stats (self, slot, packet, intra_flag, &stats);
+
+  if (packet) {
+    buffer = gst_mpp_video_enc_packet_to_buffer (self, slot, packet);
+    gst_mpp_video_enc_prepend_headers (self, buffer, intra_flag, refresh);
+    stats.size = gst_buffer_get_size (buffer);
+    gst_mpp_video_enc_update_stats (self, &stats);
+  }
+
+  if (self->mpi->enqueue (self->mpp_ctx, MPP_PORT_OUTPUT, task)) {
+    GST_ERROR_OBJECT (self, "mpp task output enqueue failed");
+    ret = GST_FLOW_ERROR;
+  }
+
+  frame_number = slot->frame_number;
+  gst_mpp_video_enc_slot_done (self, slot);
+
+  if (ret != GST_FLOW_OK) {
+    gst_buffer_replace (&buffer, NULL);
+    return ret;
+  }
+  if (NULL == buffer)
+    return GST_FLOW_FLUSHING;
+
+  frame = gst_mpp_video_enc_get_frame (self, frame_number, intra_flag);
+  if (!frame) {
+    gst_buffer_unref (buffer);
+    return GST_FLOW_OK;
+  }
+
+  return gst_mpp_video_enc_push_part (self, frame, buffer, TRUE, &stats);
+}
+
+#ifdef HAVE_MPP_ENC_SPLIT_OUT
+/* MPP writes the next frames over its output buffer, the slices are copied
+ * out of it */
+static GstMemory *
+gst_mpp_video_enc_copy_packet (GstMppVideoEnc * self, MppPacket packet)
+{
+  GstMemory *mem, *converted = NULL;
+  GstMapInfo map;
+  gsize len = mpp_packet_get_length (packet);
+
+  GST_LOG_OBJECT (self, "Copying %" G_GSIZE_FORMAT " bytes slice", len);
+
+  mem = gst_allocator_alloc (NULL, len, NULL);
+  gst_memory_map (mem, &map, GST_MAP_WRITE);
+  memcpy (map.data, mpp_packet_get_pos (packet), len);
+  if (self->length_prefixed)
+    converted = gst_mpp_video_enc_to_length_prefixed (self, map.data, &len);
+  gst_memory_unmap (mem, &map);
+
+  if (converted) {
+    gst_memory_unref (mem);
+    return converted;
+  }
+  gst_memory_resize (mem, 0, len);
+
+  return mem;
+}
+
+/* Push the frame of @slot slice by slice, as MPP encodes them. Each slice
+ * comes in its own packet, the last one of the frame marked as its end */
+static GstFlowReturn
+gst_mpp_video_enc_output_slices (GstMppVideoEnc * self,
+    GstMppVideoEncSlot * slot)
+{
+  GstVideoCodecFrame *frame = NULL;
+  GstBuffer *buffer = NULL;
+  MppPacket packet = NULL;
+  GstFlowReturn ret = GST_FLOW_OK;
+  GstMppEncStatsMeta stats;
+  guint32 frame_number = slot->frame_number;
+  gint intra_flag = 0;
+  gboolean first = TRUE, eoi;
+  gsize size = 0;
+
+  memset (&stats, 0, sizeof (stats));
+
+  do {
+    if (self->mpi->encode_get_packet (self->mpp_ctx, &packet)
+        || NULL == packet) {
+      GST_ERROR_OBJECT (self, "mpp get packet failed");
+      ret = GST_FLOW_ERROR;
+      break;
+    }
+
+    /* A frame left whole is a single packet */
+    eoi = !mpp_packet_is_partition (packet) || mpp_packet_is_eoi (packet);
+
+    if (first) {
+      gboolean refresh;
+
+      if (mpp_packet_has_meta (packet))
+        mpp_meta_get_s32 (mpp_packet_get_meta (packet), KEY_OUTPUT_INTRA,
+            &intra_flag);
+      if (slot->force_idr && !intra_flag)
+        GST_WARNING_OBJECT (self, "frame %u was forced as a keyframe but "
+            "isn't intra coded", frame_number);
+
+      refresh = gst_mpp_video_enc_count_refresh (self, intra_flag);
+      frame = gst_mpp_video_enc_get_frame (self, frame_number, intra_flag);
+      if (frame) {
+        buffer = gst_buffer_new ();
+        gst_mpp_video_enc_prepend_headers (self, buffer, intra_flag, refresh);
+      }
+      first = FALSE;
+    }
+
+    /* Without a frame to push them to, the slices are drained */
+    if (buffer)
+      gst_buffer_append_memory (buffer,
+          gst_mpp_video_enc_copy_packet (self, packet));
+
+    if (eoi) {
+      gst_mpp_video_enc_init_stats (self, slot, packet, intra_flag, &stats);
+    } else if (buffer && self->nal_aligned) {
+      size += gst_buffer_get_size (buffer);
+      ret = gst_mpp_video_enc_push_part (self, frame, buffer, FALSE, NULL);
+      buffer = NULL;
+      if (ret == GST_FLOW_OK) {
+        buffer = gst_buffer_new ();
+      } else {
+        gst_video_codec_frame_unref (frame);
+        frame = NULL;
+      }
+    }
+
+    mpp_packet_deinit (&packet);
+  } while (!eoi);
+
+  gst_mpp_video_enc_slot_done (self, slot);
+
+  if (ret != GST_FLOW_OK || !frame) {
+    gst_buffer_replace (&buffer, NULL);
+    if (frame)
+      gst_video_codec_frame_unref (frame);
+    return ret;
+  }
+
+  stats.size = size + gst_buffer_get_size (buffer);
+  gst_mpp_video_enc_update_stats (self, &stats);
+
+  return gst_mpp_video_enc_push_part (self, frame, buffer, TRUE, &stats);
+}
+#endif
+
+/* Output thread: push the frames in the order they were submitted */
+static void
+gst_mpp_video_enc_loop (GstVideoEncoder * encoder)
+{
+  GstMppVideoEnc *self = GST_MPP_VIDEO_ENC (encoder);
+  GstMppVideoEncSlot *slot;
+  GstFlowReturn ret = GST_FLOW_OK;
+
+  g_mutex_lock (&self->lock);
+  while (self->pending == 0 && !self->flushing)
+    g_cond_wait (&self->cond, &self->lock);
+  if (self->flushing) {
+    g_mutex_unlock (&self->lock);
+    ret = GST_FLOW_FLUSHING;
+    goto beach;
+  }
+  slot = &self->slots[(self->head + self->max_pending - self->pending)
+      % self->max_pending];
+  g_mutex_unlock (&self->lock);
+
+#ifdef HAVE_MPP_ENC_SPLIT_OUT
+  if (self->low_delay)
+    ret = gst_mpp_video_enc_output_slices (self, slot);
+  else
+#endif
+    ret = gst_mpp_video_enc_output_task (self, slot);
+  if (ret != GST_FLOW_OK)
+    goto beach;
+
+  return;
+
+beach:
+  GST_DEBUG_OBJECT (self, "Leaving output thread: %s", gst_flow_get_name (ret));
+
+  /* Wake up the input side waiting for a slot */
+  g_mutex_lock (&self->lock);
+  self->output_flow = ret;
+  g_cond_broadcast (&self->cond);
+  g_mutex_unlock (&self->lock);
+  gst_pad_pause_task (encoder->srcpad);
+}
+
+/* The hardware reads the frame with the layout programmed in set_format */
+static gboolean
+gst_mpp_video_enc_layout_matches (GstMppVideoEnc * self, GstBuffer * buffer)
+{
+  GstVideoInfo *info = &self->info;
+  GstVideoMeta *meta;
+  guint i;
+
+  meta = gst_buffer_get_video_meta (buffer);
+
+  for (i = 0; i < GST_VIDEO_INFO_N_PLANES (info); i++) {
+    gsize offset;
+    gint stride;
+
+    if (meta) {
+      offset = meta->offset[i];
+      stride = meta->stride[i];
+    } else {
+      offset = GST_VIDEO_INFO_PLANE_OFFSET (&self->input_state->info, i);
+      stride = GST_VIDEO_INFO_PLANE_STRIDE (&self->input_state->info, i);
+    }
+
+    if (offset != GST_VIDEO_INFO_PLANE_OFFSET (info, i)
+        || stride != GST_VIDEO_INFO_PLANE_STRIDE (info, i))
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Import a dmabuf backed frame, the MppBuffer is cached by fd and the inode
+ * tells when the number got reused for another dmabuf */
+static MppBuffer
+gst_mpp_video_enc_import_input (GstMppVideoEnc * self, GstBuffer * inbuf,
+    gsize size)
+{
+  GstMppVideoEncImport *import;
+  MppBufferInfo commit = { 0, };
+  MppBuffer mpp_buf = NULL;
+  GstMppMemory *mpp_mem;
+  GstMemory *mem;
+  struct stat st;
+  gsize offset, maxsize;
+  gint fd;
+
+  if (gst_buffer_n_memory (inbuf) != 1)
+    return NULL;
+
+  mem = gst_buffer_peek_memory (inbuf, 0);
+  if (!gst_is_dmabuf_memory (mem))
+    return NULL;
+
+  gst_memory_get_sizes (mem, &offset, &maxsize);
+  if (offset != 0 || maxsize < size)
+    return NULL;
+
+  /* Frames of the decoders already are MPP buffers, they are encoded in
+   * place while the frame holds them */
+  mpp_mem = gst_mini_object_get_qdata (GST_MINI_OBJECT (mem),
+      GST_MPP_MEMORY_QUARK);
+  if (mpp_mem && gst_is_mpp_memory (GST_MEMORY_CAST (mpp_mem)))
+    return mpp_mem->mpp_buf;
+
+  fd = gst_dmabuf_memory_get_fd (mem);
+  if (fstat (fd, &st) < 0)
+    return NULL;
+
+  import = g_hash_table_lookup (self->import_cache, GINT_TO_POINTER (fd));
+  if (import && import->dev == st.st_dev && import->ino == st.st_ino)
+    return import->mpp_buf;
+
+  if (!self->import_group) {
+    mpp_buffer_group_get_external (&self->import_group,
+        MPP_BUFFER_TYPE_EXT_DMA);
+    if (!self->import_group)
+      return NULL;
+  }
+
+  /* Sources allocating a new dmabuf for each frame */
+  if (g_hash_table_size (self->import_cache) >= MPP_MAX_IMPORTS) {
+    GST_DEBUG_OBJECT (self, "too many imported buffers, flushing the cache");
+    g_hash_table_remove_all (self->import_cache);
+  }
+
+  commit.type = MPP_BUFFER_TYPE_EXT_DMA;
+  commit.fd = dup (fd);
+  commit.size = maxsize;
+  if (commit.fd < 0)
+    return NULL;
+
+  if (mpp_buffer_import_with_tag (self->import_group, &commit, &mpp_buf,
+          NULL, __FUNCTION__)) {
+    GST_WARNING_OBJECT (self, "failed to import dmabuf %d", fd);
+    close (commit.fd);
+    return NULL;
+  }
+
+  import = g_slice_new (GstMppVideoEncImport);
+  import->mpp_buf = mpp_buf;
+  import->dev = st.st_dev;
+  import->ino = st.st_ino;
+  g_hash_table_replace (self->import_cache, GINT_TO_POINTER (fd), import);
+
+  GST_DEBUG_OBJECT (self, "imported dmabuf fd %d", fd);
+
+  return mpp_buf;
+}
+
+/* Submit a frame without waiting for its result, blocks only when all the
+ * slots are in flight */
+/* Strides of @buffer when MPP can read it as it is: the chroma right after
+ * ver_stride lines of luma, with a stride following the luma one */
+static gboolean
+gst_mpp_video_enc_get_strides (GstMppVideoEnc * self, GstBuffer * buffer,
+    guint * hor_stride, guint * ver_stride, gsize * size)
+{
+  GstVideoInfo *info = &self->input_state->info;
+  GstVideoMeta *meta;
+  gsize offset[GST_VIDEO_MAX_PLANES];
+  gint stride[GST_VIDEO_MAX_PLANES];
+  guint i, height = GST_VIDEO_INFO_HEIGHT (info);
+
+  meta = gst_buffer_get_video_meta (buffer);
+
+  for (i = 0; i < GST_VIDEO_INFO_N_PLANES (info); i++) {
+    if (meta) {
+      offset[i] = meta->offset[i];
+      stride[i] = meta->stride[i];
+    } else {
+      offset[i] = GST_VIDEO_INFO_PLANE_OFFSET (info, i);
+      stride[i] = GST_VIDEO_INFO_PLANE_STRIDE (info, i);
+    }
+  }
+
+  if (offset[0] != 0 || stride[0] <= 0)
+    return FALSE;
+
+  switch (GST_VIDEO_INFO_FORMAT (info)) {
+    case GST_VIDEO_FORMAT_NV12:
+    case GST_VIDEO_FORMAT_NV21:
+    case GST_VIDEO_FORMAT_NV16:
+    case GST_VIDEO_FORMAT_I420:
+      if (offset[1] % stride[0])
+        return FALSE;
+      *ver_stride = offset[1] / stride[0];
+      if (*ver_stride < height || *ver_stride % 2)
+        return FALSE;
+
+      if (GST_VIDEO_INFO_FORMAT (info) == GST_VIDEO_FORMAT_NV16) {
+        if (stride[1] != stride[0])
+          return FALSE;
+        *size = offset[1] + stride[1] * *ver_stride;
+      } else if (GST_VIDEO_INFO_FORMAT (info) != GST_VIDEO_FORMAT_I420) {
+        if (stride[1] != stride[0])
+          return FALSE;
+        *size = offset[1] + stride[1] * (*ver_stride / 2);
+      } else {
+        if (stride[0] % 2 || stride[1] != stride[0] / 2
+            || stride[2] != stride[1]
+            || offset[2] != offset[1] + stride[1] * (*ver_stride / 2))
+          return FALSE;
+        *size = offset[2] + stride[2] * (*ver_stride / 2);
+      }
+      break;
+    case GST_VIDEO_FORMAT_YUY2:
+    case GST_VIDEO_FORMAT_UYVY:
+    case GST_VIDEO_FORMAT_BGRx:
+    case GST_VIDEO_FORMAT_BGRA:
+    case GST_VIDEO_FORMAT_RGBx:
+    case GST_VIDEO_FORMAT_RGBA:
+    case GST_VIDEO_FORMAT_xRGB:
+    case GST_VIDEO_FORMAT_ARGB:
+    case GST_VIDEO_FORMAT_xBGR:
+    case GST_VIDEO_FORMAT_ABGR:
+    case GST_VIDEO_FORMAT_RGB:
+    case GST_VIDEO_FORMAT_BGR:
+      *ver_stride = height;
+      *size = stride[0] * height;
+      break;
+    default:
+      return FALSE;
+  }
+
+  *hor_stride = stride[0];
+
+  return TRUE;
+}
+
+/* Copy the frame into an internal buffer, converting it to NV12 when
+ * set_format picked a kernel, plane by plane unless it already has the
+ * internal layout */
+static gboolean
+gst_mpp_video_enc_copy_frame (GstMppVideoEnc * self, GstBuffer * inbuf,
+    MppBuffer mpp_buf)
+{
+  GstVideoFrame src, dst;
+  GstBuffer *outbuf;
+  gboolean ret;
+
+  if (self->convert) {
+    if (!gst_video_frame_map (&src, &self->input_state->info, inbuf,
+            GST_MAP_READ))
+      return FALSE;
+
+    self->convert (&src, mpp_buffer_get_ptr (mpp_buf),
+        GST_VIDEO_INFO_PLANE_STRIDE (&self->copy_info, 0), self->ver_stride);
+
+    gst_video_frame_unmap (&src);
+    return TRUE;
+  }
+
+  if (gst_mpp_video_enc_layout_matches (self, inbuf)) {
+    gst_buffer_extract (inbuf, 0, mpp_buffer_get_ptr (mpp_buf),
+        MIN (gst_buffer_get_size (inbuf), mpp_buffer_get_size (mpp_buf)));
+    return TRUE;
+  }
+
+  GST_LOG_OBJECT (self, "Repacking the frame into the internal layout");
+
+  if (!gst_video_frame_map (&src, &self->input_state->info, inbuf,
+          GST_MAP_READ))
+    return FALSE;
+
+  outbuf = gst_buffer_new_wrapped_full (0, mpp_buffer_get_ptr (mpp_buf),
+      mpp_buffer_get_size (mpp_buf), 0, GST_VIDEO_INFO_SIZE (&self->info),
+      NULL, NULL);
+  if (!gst_video_frame_map (&dst, &self->info, outbuf, GST_MAP_WRITE)) {
+    gst_video_frame_unmap (&src);
+    gst_buffer_unref (outbuf);
+    return FALSE;
+  }
+
+  ret = gst_video_frame_copy (&dst, &src);
+
+  gst_video_frame_unmap (&dst);
+  gst_video_frame_unmap (&src);
+  gst_buffer_unref (outbuf);
+
+  return ret;
+}
+
+/* Wait for the frames in flight to be encoded. The controls of MPP apply to
+ * the whole context, from the next frame it starts on */
+static GstFlowReturn
+gst_mpp_video_enc_wait_idle (GstMppVideoEnc * self)
+{
+  GstFlowReturn ret = GST_FLOW_OK;
 
-  GST_DEBUG_OBJECT (self, "Setting format: %" GST_PTR_FORMAT, state->caps);
+  g_mutex_lock (&self->lock);
+  while (self->pending > 0 && !self->flushing
+      && self->output_flow == GST_FLOW_OK)
+    g_cond_wait (&self->cond, &self->lock);
+  if (self->flushing)
+    ret = GST_FLOW_FLUSHING;
+  else if (self->output_flow != GST_FLOW_OK)
+    ret = self->output_flow;
+  g_mutex_unlock (&self->lock);
 
-  if (self->input_state) {
-    if (gst_caps_is_strictly_equal (self->input_state->caps, state->caps)) {
-      GST_DEBUG_OBJECT (self, "Compatible caps");
-      goto done;
-    }
-  }
+  return ret;
+}
 
-  format = state->info.finfo->format;
+/* Follow the format and strides of the frames, once the previous ones are
+ * encoded */
+static GstFlowReturn
+gst_mpp_video_enc_set_prep (GstMppVideoEnc * self, MppFrameFormat format,
+    guint hor_stride, guint ver_stride)
+{
+  GstFlowReturn ret;
+  MppEncPrepCfg prep_cfg;
 
-  info = &self->info;
-  gst_video_info_init (info);
-  gst_video_info_set_format (info, format, GST_VIDEO_INFO_WIDTH (&state->info),
-      GST_VIDEO_INFO_HEIGHT (&state->info));
+  if (format == self->prep_format && hor_stride == self->prep_hor_stride
+      && ver_stride == self->prep_ver_stride)
+    return GST_FLOW_OK;
 
-  switch (info->finfo->format) {
-    case GST_VIDEO_FORMAT_NV12:
-    case GST_VIDEO_FORMAT_I420:
-      ver_stride = GST_ROUND_UP_16 (GST_VIDEO_INFO_HEIGHT (info));
-      info->offset[0] = 0;
-      info->offset[1] = info->stride[0] * ver_stride;
-      cr_h = GST_ROUND_UP_2 (ver_stride) / 2;
-      info->size = info->offset[1] + info->stride[0] * cr_h;
-      break;
-    case GST_VIDEO_FORMAT_YUY2:
-    case GST_VIDEO_FORMAT_UYVY:
-      ver_stride = GST_ROUND_UP_16 (GST_VIDEO_INFO_HEIGHT (info));
-      cr_h = GST_ROUND_UP_2 (ver_stride);
-      info->size = info->stride[0] * cr_h;
-      break;
-    default:
-      g_assert_not_reached ();
-      return FALSE;
-  }
+  ret = gst_mpp_video_enc_wait_idle (self);
+  if (ret != GST_FLOW_OK)
+    return ret;
+
+  GST_DEBUG_OBJECT (self, "Input changed to format %d, strides %ux%u",
+      format, hor_stride, ver_stride);
 
   memset (&prep_cfg, 0, sizeof (prep_cfg));
   prep_cfg.change = MPP_ENC_PREP_CFG_CHANGE_INPUT |
       MPP_ENC_PREP_CFG_CHANGE_FORMAT;
-  prep_cfg.width = GST_VIDEO_INFO_WIDTH (&state->info);
-  prep_cfg.height = GST_VIDEO_INFO_HEIGHT (&state->info);
-  prep_cfg.format = to_mpp_pixel (state->caps, &state->info);
-  prep_cfg.hor_stride = info->stride[0];
+  prep_cfg.width = GST_VIDEO_INFO_WIDTH (&self->info);
+  prep_cfg.height = GST_VIDEO_INFO_HEIGHT (&self->info);
+  prep_cfg.format = format;
+  prep_cfg.hor_stride = hor_stride;
   prep_cfg.ver_stride = ver_stride;
 
   if (self->mpi->control (self->mpp_ctx, MPP_ENC_SET_PREP_CFG, &prep_cfg)) {
-    GST_DEBUG_OBJECT (self, "Setting input format for rockchip mpp failed");
-    return FALSE;
+    GST_ERROR_OBJECT (self, "failed to set the input format");
+    return GST_FLOW_ERROR;
   }
 
-  if (self->mpi->control
-      (self->mpp_ctx, MPP_ENC_GET_EXTRA_INFO, &self->sps_packet))
-    self->sps_packet = NULL;
-
-  self->input_state = gst_video_codec_state_ref (state);
+  self->prep_format = format;
+  self->prep_hor_stride = hor_stride;
+  self->prep_ver_stride = ver_stride;
 
-done:
-  return TRUE;
+  return GST_FLOW_OK;
 }
 
-static gboolean
-gst_mpp_video_enc_flush (GstVideoEncoder * encoder)
+#ifdef HAVE_MPP_ENC_ROI
+/* Fill the regions of interest of the slot from the metas of the frame */
+static guint
+gst_mpp_video_enc_set_roi (GstMppVideoEnc * self, GstMppVideoEncSlot * slot,
+    GstVideoCodecFrame * frame)
 {
-  GstMppVideoEnc *self = GST_MPP_VIDEO_ENC (encoder);
+  GstMppRoiRegion regions[MPP_MAX_ROI_REGIONS];
+  gint roi_qp_delta, bg_qp_delta;
+  guint i, n;
+
+  GST_OBJECT_LOCK (self);
+  roi_qp_delta = self->roi_qp_delta;
+  bg_qp_delta = self->bg_qp_delta;
+  GST_OBJECT_UNLOCK (self);
+
+  n = gst_mpp_roi_from_buffer (frame->input_buffer, &self->info,
+      roi_qp_delta, bg_qp_delta, regions, MPP_MAX_ROI_REGIONS);
+
+  memset (slot->roi_regions, 0, sizeof (slot->roi_regions));
+  for (i = 0; i < n; i++) {
+    MppEncROIRegion *region = &slot->roi_regions[i];
+
+    region->x = regions[i].x;
+    region->y = regions[i].y;
+    region->w = regions[i].w;
+    region->h = regions[i].h;
+    region->quality = regions[i].qp_delta;
+    region->area_map_en = 1;
+    region->abs_qp_en = 0;
+  }
+  slot->roi_cfg.number = n;
+  slot->roi_cfg.regions = slot->roi_regions;
 
-  GST_DEBUG_OBJECT (self, "Flushing");
+  return n;
+}
+#endif
 
-  if (g_atomic_int_get (&self->processing)) {
-    GST_VIDEO_ENCODER_STREAM_UNLOCK (encoder);
-    self->mpi->reset (self->mpp_ctx);
+/* Hand the frame of @slot to MPP as a task, along with the output buffer
+ * the packet is written to */
+static GstFlowReturn
+gst_mpp_video_enc_put_task (GstMppVideoEnc * self, GstMppVideoEncSlot * slot,
+    GstVideoCodecFrame * frame)
+{
+  MppTask task = NULL;
 
-    gst_mpp_video_enc_process_buffer_stopped (self);
+  /* The previous output buffers of this slot may still be downstream, the
+   * group reuses the released ones and allocates more when needed */
+  if (mpp_buffer_get (self->output_group, &slot->output_buffer,
+          self->packet_size)) {
+    GST_ERROR_OBJECT (self, "failed to get an output buffer");
+    return GST_FLOW_ERROR;
+  }
 
-    GST_VIDEO_ENCODER_STREAM_LOCK (encoder);
+  if (self->mpi->poll (self->mpp_ctx, MPP_PORT_INPUT, MPP_POLL_BLOCK)
+      || self->mpi->dequeue (self->mpp_ctx, MPP_PORT_INPUT, &task)
+      || NULL == task) {
+    GST_ERROR_OBJECT (self, "mpp task input dequeue failed");
+    return GST_FLOW_ERROR;
   }
-  self->output_flow = GST_FLOW_OK;
+  mpp_task_meta_set_frame (task, KEY_INPUT_FRAME, slot->mpp_frame);
+#ifdef HAVE_MPP_ENC_ROI
+  if (gst_mpp_video_enc_set_roi (self, slot, frame))
+    mpp_task_meta_set_ptr (task, KEY_ROI_DATA, &slot->roi_cfg);
+#endif
 
-  self->mpi->reset (self->mpp_ctx);
+  mpp_packet_init_with_buffer (&slot->packet, slot->output_buffer);
+  mpp_task_meta_set_packet (task, KEY_OUTPUT_PACKET, slot->packet);
+  slot->submit_time = g_get_monotonic_time ();
 
-  return TRUE;
+  if (self->mpi->enqueue (self->mpp_ctx, MPP_PORT_INPUT, task)) {
+    GST_ERROR_OBJECT (self, "mpp task input enqueue failed");
+    return GST_FLOW_ERROR;
+  }
+
+  return GST_FLOW_OK;
 }
 
-static GstVideoCodecFrame *
-gst_mpp_video_enc_get_oldest_frame (GstVideoEncoder * encoder)
+#ifdef HAVE_MPP_ENC_SPLIT_OUT
+/* Hand the frame of @slot to MPP for low delay output, the packets come in
+ * MPP's own buffers, one per slice */
+static GstFlowReturn
+gst_mpp_video_enc_put_frame (GstMppVideoEnc * self, GstMppVideoEncSlot * slot,
+    GstVideoCodecFrame * frame)
 {
-  GstVideoCodecFrame *frame = NULL;
-  GList *frames, *l;
-  gint count = 0;
+  if (!self->io_started) {
+    MppPollType timeout = MPP_POLL_BLOCK;
 
-  frames = gst_video_encoder_get_frames (encoder);
+    /* The output thread only asks for the packets of submitted frames */
+    if (self->mpi->control (self->mpp_ctx, MPP_SET_OUTPUT_TIMEOUT, &timeout)) {
+      GST_ERROR_OBJECT (self, "failed to make the output blocking");
+      return GST_FLOW_ERROR;
+    }
+  }
 
-  for (l = frames; l != NULL; l = l->next) {
-    GstVideoCodecFrame *f = l->data;
+#ifdef HAVE_MPP_ENC_ROI
+  /* The meta of the frame is kept from one use of the slot to the next */
+  mpp_meta_set_ptr (mpp_frame_get_meta (slot->mpp_frame), KEY_ROI_DATA,
+      gst_mpp_video_enc_set_roi (self, slot, frame) ? &slot->roi_cfg : NULL);
+#endif
 
-    if (!frame || frame->pts > f->pts)
-      frame = f;
+  slot->submit_time = g_get_monotonic_time ();
 
-    count++;
-  }
-  if (frame) {
-    GST_LOG_OBJECT (encoder,
-        "Oldest frame is %d %" GST_TIME_FORMAT
-        " and %d frames left",
-        frame->system_frame_number, GST_TIME_ARGS (frame->pts), count - 1);
-    gst_video_codec_frame_ref (frame);
+  if (self->mpi->encode_put_frame (self->mpp_ctx, slot->mpp_frame)) {
+    GST_ERROR_OBJECT (self, "mpp put frame failed");
+    return GST_FLOW_ERROR;
   }
 
-  g_list_free_full (frames, (GDestroyNotify) gst_video_codec_frame_unref);
-
-  return frame;
+  return GST_FLOW_OK;
 }
+#endif
 
 static GstFlowReturn
-gst_mpp_video_enc_process_buffer (GstMppVideoEnc * self, GstBuffer * buffer)
+gst_mpp_video_enc_send_frame (GstMppVideoEnc * self, GstVideoCodecFrame * frame)
 {
-  GstVideoEncoder *encoder = GST_VIDEO_ENCODER (self);
-  GstBuffer *new_buffer = NULL;
-  static gint8 current_index = 0;
-  GstVideoCodecFrame *frame;
-  gpointer ptr = NULL;
-  MppFrame mpp_frame = self->mpp_frame;
-  MppTask task = NULL;
-  MppBuffer frame_in = self->input_buffer[current_index];
-  MppBuffer pkt_buf_out = self->output_buffer[current_index];
-  MppPacket packet = NULL;
-  GstFlowReturn ret;
-
-  mpp_frame_set_buffer (mpp_frame, frame_in);
-  /* Eos buffer */
-  if (0 == gst_buffer_get_size (buffer)) {
-    mpp_frame_set_eos (mpp_frame, 1);
-  } else {
-    ptr = mpp_buffer_get_ptr (frame_in);
+  GstMppVideoEncSlot *slot;
+  GstFlowReturn ret = GST_FLOW_OK;
+  MppBuffer mpp_buf = NULL;
+  MppFrameFormat format;
+  guint hor_stride, ver_stride;
+  gsize size;
+
+  g_mutex_lock (&self->lock);
+  while (self->pending == self->max_pending && !self->flushing
+      && self->output_flow == GST_FLOW_OK)
+    g_cond_wait (&self->cond, &self->lock);
+  if (self->flushing)
+    ret = GST_FLOW_FLUSHING;
+  else if (self->output_flow != GST_FLOW_OK)
+    ret = self->output_flow;
+  slot = &self->slots[self->head];
+  g_mutex_unlock (&self->lock);
 
-    gst_buffer_ref (buffer);
-    gst_buffer_extract (buffer, 0, ptr, gst_buffer_get_size (buffer));
-    gst_buffer_unref (buffer);
+  if (ret != GST_FLOW_OK)
+    return ret;
 
-    mpp_frame_set_eos (mpp_frame, 0);
-  }
+  if (gst_mpp_video_enc_get_strides (self, frame->input_buffer, &hor_stride,
+          &ver_stride, &size))
+    mpp_buf = gst_mpp_video_enc_import_input (self, frame->input_buffer, size);
 
-  do {
-    if (self->mpi->dequeue (self->mpp_ctx, MPP_PORT_INPUT, &task)) {
-      GST_ERROR_OBJECT (self, "mpp task input dequeue failed");
+  if (mpp_buf) {
+    /* Both are released once the frame is encoded */
+    mpp_buffer_inc_ref (mpp_buf);
+    slot->import_buffer = mpp_buf;
+    slot->inbuf = gst_buffer_ref (frame->input_buffer);
+    format = to_mpp_pixel (self->input_state->caps, &self->input_state->info);
+  } else {
+    /* System memory, or a layout the hardware can't read */
+    if (!gst_mpp_video_enc_copy_frame (self, frame->input_buffer,
+            slot->input_buffer)) {
+      GST_ERROR_OBJECT (self, "failed to copy the frame");
       return GST_FLOW_ERROR;
     }
-    if (NULL == task) {
-      GST_LOG_OBJECT (self, "mpp input failed, try again");
-      g_usleep (2);
-    } else {
-      break;
+    mpp_buf = slot->input_buffer;
+    format = to_mpp_pixel (self->input_state->caps, &self->copy_info);
+    hor_stride = GST_VIDEO_INFO_PLANE_STRIDE (&self->copy_info, 0);
+    ver_stride = self->ver_stride;
+  }
+
+  ret = gst_mpp_video_enc_set_prep (self, format, hor_stride, ver_stride);
+  if (ret != GST_FLOW_OK) {
+    gst_mpp_video_enc_slot_release (slot);
+    return ret;
+  }
+
+  /* Requested by a force-key-unit event, don't wait for the next GOP. The
+   * request is for the next frame MPP starts on, so it must be this one */
+  if (GST_VIDEO_CODEC_FRAME_IS_FORCE_KEYFRAME (frame)) {
+    ret = gst_mpp_video_enc_wait_idle (self);
+    if (ret != GST_FLOW_OK) {
+      gst_mpp_video_enc_slot_release (slot);
+      return ret;
     }
-  } while (1);
-  mpp_task_meta_set_frame (task, KEY_INPUT_FRAME, mpp_frame);
 
-  mpp_packet_init_with_buffer (&packet, pkt_buf_out);
-  mpp_task_meta_set_packet (task, KEY_OUTPUT_PACKET, packet);
+    GST_DEBUG_OBJECT (self, "Forcing an IDR for frame %u",
+        frame->system_frame_number);
+    if (self->mpi->control (self->mpp_ctx, MPP_ENC_SET_IDR_FRAME, NULL))
+      GST_WARNING_OBJECT (self, "failed to request an IDR frame");
+    else
+      slot->force_idr = TRUE;
+  }
 
-  if (self->mpi->enqueue (self->mpp_ctx, MPP_PORT_INPUT, task)) {
-    GST_ERROR_OBJECT (self, "mpp task input enqueu failed");
+  mpp_frame_set_hor_stride (slot->mpp_frame, hor_stride);
+  mpp_frame_set_ver_stride (slot->mpp_frame, ver_stride);
+  mpp_frame_set_buffer (slot->mpp_frame, mpp_buf);
+  mpp_frame_set_eos (slot->mpp_frame, 0);
+  slot->frame_number = frame->system_frame_number;
+
+#ifdef HAVE_MPP_ENC_SPLIT_OUT
+  if (self->low_delay)
+    ret = gst_mpp_video_enc_put_frame (self, slot, frame);
+  else
+#endif
+    ret = gst_mpp_video_enc_put_task (self, slot, frame);
+  if (ret != GST_FLOW_OK) {
+    gst_mpp_video_enc_slot_release (slot);
+    return ret;
   }
+  self->io_started = TRUE;
 
-  GST_LOG_OBJECT (self, "Process output buffer");
+  g_mutex_lock (&self->lock);
+  self->head = (self->head + 1) % self->max_pending;
+  self->pending++;
+  g_cond_broadcast (&self->cond);
+  g_mutex_unlock (&self->lock);
 
-  do {
-    MppFrame packet_out = NULL;
-    ret = GST_FLOW_OK;
+  GST_LOG_OBJECT (self, "frame %u submitted, %u in flight",
+      frame->system_frame_number, self->pending);
 
-    if (self->mpi->dequeue (self->mpp_ctx, MPP_PORT_OUTPUT, &task)) {
-      g_usleep (2);
-      continue;
-    }
+  return GST_FLOW_OK;
+}
 
-    if (task) {
-      mpp_task_meta_get_packet (task, KEY_OUTPUT_PACKET, &packet_out);
-      g_assert (packet_out == packet);
-
-      /* Get result */
-      if (packet) {
-        gconstpointer *ptr = mpp_packet_get_pos (packet);
-        gsize len = mpp_packet_get_length (packet);
-        gint intra_flag = 0;
-
-        if (mpp_packet_get_eos (packet))
-          ret = GST_FLOW_EOS;
-
-        mpp_task_meta_get_s32 (task, KEY_OUTPUT_INTRA, &intra_flag, 0);
-
-        GST_LOG_OBJECT (self, "Allocate output buffer");
-        if (intra_flag)
-          new_buffer = gst_video_encoder_allocate_output_buffer (encoder,
-              MAX_EXTRA_DATA + len);
-        else
-          new_buffer = gst_video_encoder_allocate_output_buffer (encoder, len);
-        if (NULL == new_buffer) {
-          ret = GST_FLOW_FLUSHING;
-          goto beach;
-        }
+/* A frame is late once it waited, since its running time, longer than the
+ * frames in flight would take at the frame rate. Forced keyframes are
+ * always encoded, the other frames only reference encoded ones */
+static gboolean
+gst_mpp_video_enc_is_late (GstMppVideoEnc * self, GstVideoCodecFrame * frame,
+    GstClockTimeDiff * jitter)
+{
+  GstVideoEncoder *encoder = GST_VIDEO_ENCODER (self);
+  GstVideoInfo *info = &self->input_state->info;
+  GstClockTime running_time, duration;
+  GstClock *clock;
+  GstClockTime now;
 
-        /* Fill the buffer */
-        if (intra_flag && self->sps_packet) {
-          const gpointer *sps_ptr = mpp_packet_get_pos (self->sps_packet);
-          gsize sps_len = mpp_packet_get_length (self->sps_packet);
+  if (GST_VIDEO_CODEC_FRAME_IS_FORCE_KEYFRAME (frame))
+    return FALSE;
 
-          gst_buffer_fill (new_buffer, 0, sps_ptr, sps_len);
+  running_time = gst_segment_to_running_time (&encoder->input_segment,
+      GST_FORMAT_TIME, frame->pts);
+  if (!GST_CLOCK_TIME_IS_VALID (running_time))
+    return FALSE;
 
-          gst_buffer_fill (new_buffer, sps_len, ptr, len);
-        } else {
-          gst_buffer_fill (new_buffer, 0, ptr, len);
-        }
+  duration = frame->duration;
+  if (!GST_CLOCK_TIME_IS_VALID (duration)) {
+    if (GST_VIDEO_INFO_FPS_N (info) <= 0)
+      return FALSE;
+    duration = gst_util_uint64_scale (GST_SECOND, GST_VIDEO_INFO_FPS_D (info),
+        GST_VIDEO_INFO_FPS_N (info));
+  }
 
-        mpp_packet_deinit (&packet);
-      }
+  clock = gst_element_get_clock (GST_ELEMENT (self));
+  if (!clock)
+    return FALSE;
+  now = gst_clock_get_time (clock);
+  gst_object_unref (clock);
 
-      if (self->mpi->enqueue (self->mpp_ctx, MPP_PORT_OUTPUT, task)) {
-        GST_ERROR_OBJECT (self, "mpp task output enqueue failed");
-        ret = GST_FLOW_ERROR;
-      }
-      current_index++;
-      if (current_index >= MPP_MAX_BUFFERS)
-        current_index = 0;
-      break;
+  *jitter = GST_CLOCK_DIFF (running_time + gst_element_get_base_time
+      (GST_ELEMENT (self)), now);
+
+  return *jitter > (GstClockTimeDiff) (duration * self->max_pending);
+}
+
+/* Drop a late frame, telling the application about it */
+static GstFlowReturn
+gst_mpp_video_enc_drop_late (GstMppVideoEnc * self,
+    GstVideoCodecFrame * frame, GstClockTimeDiff jitter)
+{
+  GstVideoEncoder *encoder = GST_VIDEO_ENCODER (self);
+  GstSegment *segment = &encoder->input_segment;
+  guint64 processed, dropped;
+  GstMessage *msg;
+
+  GST_OBJECT_LOCK (self);
+  processed = self->stats_frames;
+  dropped = ++self->stats_dropped;
+  GST_OBJECT_UNLOCK (self);
+
+  GST_DEBUG_OBJECT (self, "Dropping frame %d, late by %" GST_STIME_FORMAT,
+      frame->system_frame_number, GST_STIME_ARGS (jitter));
+
+  msg = gst_message_new_qos (GST_OBJECT_CAST (self), TRUE,
+      gst_segment_to_running_time (segment, GST_FORMAT_TIME, frame->pts),
+      gst_segment_to_stream_time (segment, GST_FORMAT_TIME, frame->pts),
+      frame->pts, frame->duration);
+  gst_message_set_qos_values (msg, jitter, 1.0, 1000000);
+  gst_message_set_qos_stats (msg, GST_FORMAT_BUFFERS, processed, dropped);
+  gst_element_post_message (GST_ELEMENT_CAST (self), msg);
+
+  /* Without an output buffer, the frame is dropped */
+  return gst_video_encoder_finish_frame (encoder, frame);
+}
+
+/* Set the slots up for the current format. The buffers are kept when the
+ * frames still fit in them, after a renegotiation */
+static gboolean
+gst_mpp_video_enc_alloc_slots (GstMppVideoEnc * self)
+{
+  gboolean realloc;
+  guint i;
+
+  if (!self->input_group && mpp_buffer_group_get_internal (&self->input_group,
+          MPP_BUFFER_TYPE_ION))
+    return FALSE;
+  if (!self->output_group
+      && mpp_buffer_group_get_internal (&self->output_group,
+          MPP_BUFFER_TYPE_ION))
+    return FALSE;
+
+  realloc = GST_VIDEO_INFO_SIZE (&self->info) > self->input_size;
+  if (realloc)
+    GST_DEBUG_OBJECT (self, "Allocating %" G_GSIZE_FORMAT " bytes input "
+        "buffers", GST_VIDEO_INFO_SIZE (&self->info));
+
+  for (i = 0; i < self->max_pending; i++) {
+    GstMppVideoEncSlot *slot = &self->slots[i];
+
+    if (realloc && slot->input_buffer) {
+      mpp_buffer_put (slot->input_buffer);
+      slot->input_buffer = NULL;
     }
-  } while (1);
-  if (ret != GST_FLOW_OK)
-    goto beach;
 
-  frame = gst_mpp_video_enc_get_oldest_frame (encoder);
-  if (frame) {
-    frame->output_buffer = new_buffer;
-    new_buffer = NULL;
-    ret = gst_video_encoder_finish_frame (encoder, frame);
+    if (!slot->input_buffer && mpp_buffer_get (self->input_group,
+            &slot->input_buffer, GST_VIDEO_INFO_SIZE (&self->info)))
+      return FALSE;
 
-    if (ret != GST_FLOW_OK)
-      goto beach;
-  } else {
-    GST_WARNING_OBJECT (self, "Encoder is producing too many buffers");
-    gst_buffer_unref (new_buffer);
+    if (!slot->mpp_frame && mpp_frame_init (&slot->mpp_frame)) {
+      GST_DEBUG_OBJECT (self, "failed to set up mpp frame");
+      return FALSE;
+    }
+
+    mpp_frame_set_width (slot->mpp_frame, GST_VIDEO_INFO_WIDTH (&self->info));
+    mpp_frame_set_height (slot->mpp_frame,
+        GST_VIDEO_INFO_HEIGHT (&self->info));
+    mpp_frame_set_hor_stride (slot->mpp_frame,
+        GST_VIDEO_INFO_PLANE_STRIDE (&self->info, 0));
+    mpp_frame_set_ver_stride (slot->mpp_frame, self->ver_stride);
   }
-  return GST_FLOW_OK;
 
-beach:
-  GST_DEBUG_OBJECT (self, "Leaving output thread");
+  if (realloc)
+    self->input_size = GST_VIDEO_INFO_SIZE (&self->info);
 
-  gst_buffer_replace (&buffer, NULL);
-  self->output_flow = ret;
-  g_atomic_int_set (&self->processing, FALSE);
-  /* FIXME maybe I need to inform the rockchip mpp */
-  return ret;
+  return TRUE;
 }
 
 static GstFlowReturn
@@ -451,6 +2339,9 @@ gst_mpp_video_enc_handle_frame (GstVideoEncoder * encoder,
 
   GstMppVideoEnc *self = GST_MPP_VIDEO_ENC (encoder);
   GstFlowReturn ret = GST_FLOW_OK;
+  GstTaskState task_state;
+  GstClockTimeDiff jitter;
+  gboolean realtime;
 
   GST_DEBUG_OBJECT (self, "Handling frame %d", frame->system_frame_number);
 
@@ -459,12 +2350,10 @@ gst_mpp_video_enc_handle_frame (GstVideoEncoder * encoder,
 
   /* FIXME don't use this as a flag */
   if (self->outcaps == NULL) {
-    gint i = 0;
-    gsize packet_size;
-
     GST_DEBUG_OBJECT (self, "Filling src caps with output dimensions %ux%u",
         self->info.width, self->info.height);
-    packet_size = self->info.width * self->info.height;
+    /* No packet is larger than the raw frame */
+    self->packet_size = GST_VIDEO_INFO_SIZE (&self->info);
 
     if (!outcaps)
       goto not_negotiated;
@@ -473,39 +2362,12 @@ gst_mpp_video_enc_handle_frame (GstVideoEncoder * encoder,
         "width", G_TYPE_INT, self->input_state->info.width,
         "height", G_TYPE_INT, self->input_state->info.height, NULL);
 
-    /* Allocator buffers */
-    if (mpp_buffer_group_get_internal (&self->input_group, MPP_BUFFER_TYPE_ION))
-      goto activate_failed;
-    if (mpp_buffer_group_get_internal (&self->output_group,
-            MPP_BUFFER_TYPE_ION))
-      goto activate_failed;
-
-    for (i = 0; i < MPP_MAX_BUFFERS; i++) {
-      if (mpp_buffer_get (self->input_group, &self->input_buffer[i],
-              self->info.size))
-        goto activate_failed;
-      if (mpp_buffer_get (self->output_group, &self->output_buffer[i],
-              packet_size))
-        goto activate_failed;
-    }
-
-    if (mpp_frame_init (&self->mpp_frame)) {
-      GST_DEBUG_OBJECT (self, "failed to set up mpp frame");
+    if (!gst_mpp_video_enc_alloc_slots (self))
       goto activate_failed;
-    }
-
-    mpp_frame_set_width (self->mpp_frame, GST_VIDEO_INFO_WIDTH (&self->info));
-    mpp_frame_set_height (self->mpp_frame, GST_VIDEO_INFO_HEIGHT (&self->info));
-    mpp_frame_set_hor_stride (self->mpp_frame,
-        GST_VIDEO_INFO_PLANE_STRIDE (&self->info, 0));
-    mpp_frame_set_ver_stride (self->mpp_frame,
-        GST_ROUND_UP_16 (GST_VIDEO_INFO_HEIGHT (&self->info)));
-
-    if (self->mpi->poll (self->mpp_ctx, MPP_PORT_INPUT, MPP_POLL_BLOCK))
-      GST_ERROR_OBJECT (self, "mpp input poll failed");
 
     gst_video_encoder_set_output_state (encoder, outcaps, self->input_state);
     self->outcaps = gst_caps_ref (outcaps);
+    outcaps = NULL;
 
     if (!gst_video_encoder_negotiate (encoder)) {
       if (GST_PAD_IS_FLUSHING (GST_VIDEO_ENCODER_SRC_PAD (encoder)))
@@ -513,27 +2375,53 @@ gst_mpp_video_enc_handle_frame (GstVideoEncoder * encoder,
       else
         goto not_negotiated;
     }
+  }
 
+  if (outcaps) {
+    gst_caps_unref (outcaps);
+    outcaps = NULL;
   }
-  if (g_atomic_int_get (&self->processing) == FALSE) {
-    g_atomic_int_set (&self->processing, TRUE);
+
+  GST_OBJECT_LOCK (self);
+  realtime = self->realtime;
+  GST_OBJECT_UNLOCK (self);
+
+  if (realtime && gst_mpp_video_enc_is_late (self, frame, &jitter))
+    return gst_mpp_video_enc_drop_late (self, frame, jitter);
+
+  /* Start the output thread if it is not started before */
+  task_state = gst_pad_get_task_state (GST_VIDEO_ENCODER_SRC_PAD (self));
+  if (task_state == GST_TASK_STOPPED || task_state == GST_TASK_PAUSED) {
+    /* It's possible that the output thread stopped due to an error */
+    if (self->output_flow != GST_FLOW_OK &&
+        self->output_flow != GST_FLOW_FLUSHING) {
+      GST_DEBUG_OBJECT (self, "Output loop stopped with error, leaving");
+      ret = self->output_flow;
+      goto drop;
+    }
+
+    GST_DEBUG_OBJECT (self, "Starting encoding thread");
+
+    self->output_flow = GST_FLOW_OK;
+    if (!gst_pad_start_task (encoder->srcpad,
+            (GstTaskFunction) gst_mpp_video_enc_loop, self, NULL))
+      goto start_task_failed;
   }
 
-  if (frame->input_buffer) {
-    GST_VIDEO_ENCODER_STREAM_UNLOCK (encoder);
-    ret = gst_mpp_video_enc_process_buffer (self, frame->input_buffer);
-    GST_VIDEO_ENCODER_STREAM_LOCK (encoder);
+  GST_VIDEO_ENCODER_STREAM_UNLOCK (encoder);
+  ret = gst_mpp_video_enc_send_frame (self, frame);
+  GST_VIDEO_ENCODER_STREAM_LOCK (encoder);
 
-    if (ret == GST_FLOW_FLUSHING) {
-      if (g_atomic_int_get (&self->processing) == FALSE)
-        ret = self->output_flow;
-    } else if (ret == GST_FLOW_EOS) {
-      ret = GST_FLOW_EOS;
-      return ret;
-    } else if (ret != GST_FLOW_OK) {
-      goto process_failed;
-    }
+  if (ret == GST_FLOW_FLUSHING) {
+    if (gst_pad_get_task_state (GST_VIDEO_ENCODER_SRC_PAD (self)) !=
+        GST_TASK_STARTED)
+      ret = self->output_flow;
+    goto drop;
+  } else if (ret != GST_FLOW_OK) {
+    goto process_failed;
   }
+
+  /* The frame is finished by the output thread */
   gst_video_codec_frame_unref (frame);
 
   return ret;
@@ -549,13 +2437,21 @@ activate_failed:
     GST_ELEMENT_ERROR (self, RESOURCE, SETTINGS,
         ("Failed to allocate required memory."),
         ("Buffer pool activation failed"));
-    return GST_FLOW_ERROR;
+    ret = GST_FLOW_ERROR;
+    goto drop;
   }
 flushing:
   {
     ret = GST_FLOW_FLUSHING;
     goto drop;
   }
+start_task_failed:
+  {
+    GST_ELEMENT_ERROR (self, RESOURCE, FAILED,
+        ("Failed to start encoding thread."), (NULL));
+    ret = GST_FLOW_ERROR;
+    goto drop;
+  }
 process_failed:
   {
     GST_ELEMENT_ERROR (self, RESOURCE, FAILED,
@@ -566,6 +2462,8 @@ process_failed:
   }
 drop:
   {
+    if (outcaps)
+      gst_caps_unref (outcaps);
     gst_video_encoder_finish_frame (encoder, frame);
     return ret;
   }
@@ -576,11 +2474,12 @@ gst_mpp_video_enc_propose_allocation (GstVideoEncoder * encoder,
     GstQuery * query)
 {
   GstMppVideoEnc *self = GST_MPP_VIDEO_ENC (encoder);
+  GstMppObject *obj = self->mpp_input;
   GstBufferPool *pool;
   GstCaps *caps;
   GstStructure *config;
   GstVideoInfo info;
-  guint size;
+  guint size, count;
 
   gst_query_parse_allocation (query, &caps, NULL);
   if (caps == NULL)
@@ -588,14 +2487,45 @@ gst_mpp_video_enc_propose_allocation (GstVideoEncoder * encoder,
   if (!gst_video_info_from_caps (&info, caps))
     return FALSE;
 
-  size = GST_VIDEO_INFO_SIZE (&self->info);
+  /* Let upstream render into buffers the hardware reads directly, with the
+   * strides of MPP described by the video meta */
+  if (self->input_state
+      && GST_VIDEO_INFO_FORMAT (&info) == GST_VIDEO_INFO_FORMAT (&self->info)
+      && GST_VIDEO_INFO_WIDTH (&info) == GST_VIDEO_INFO_WIDTH (&self->info)
+      && GST_VIDEO_INFO_HEIGHT (&info) == GST_VIDEO_INFO_HEIGHT (&self->info)) {
+    gst_mpp_object_close_pool (obj);
+
+    /* The buffers have the layout of MPP, which the video meta describes.
+     * It has the format and the dimensions of the caps, with taller planes,
+     * so they are never smaller than the caps require */
+    obj->info = self->info;
+    obj->need_video_meta = TRUE;
+    if (!gst_mpp_object_setup_pool (obj, caps))
+      return FALSE;
+
+    size = GST_VIDEO_INFO_SIZE (&obj->info);
+
+    /* Every frame in flight holds a buffer */
+    count = obj->min_buffers + self->max_pending;
 
-  pool = gst_video_buffer_pool_new ();
+    pool = gst_object_ref (obj->pool);
+    config = gst_buffer_pool_get_config (pool);
+    gst_buffer_pool_config_set_params (config, caps, size, count, count);
+    gst_buffer_pool_config_add_option (config,
+        GST_BUFFER_POOL_OPTION_VIDEO_META);
+    gst_buffer_pool_set_config (pool, config);
 
-  gst_query_add_allocation_pool (query, pool, size, 0, 0);
-  config = gst_buffer_pool_get_config (pool);
-  gst_buffer_pool_config_set_params (config, caps, size, 1, 0);
-  gst_buffer_pool_set_config (pool, config);
+    gst_query_add_allocation_pool (query, pool, size, count, count);
+    GST_DEBUG_OBJECT (self, "proposing our own pool %" GST_PTR_FORMAT, pool);
+  } else {
+    size = GST_VIDEO_INFO_SIZE (&info);
+    pool = gst_video_buffer_pool_new ();
+
+    gst_query_add_allocation_pool (query, pool, size, 0, 0);
+    config = gst_buffer_pool_get_config (pool);
+    gst_buffer_pool_config_set_params (config, caps, size, 1, 0);
+    gst_buffer_pool_set_config (pool, config);
+  }
 
   gst_object_unref (pool);
   gst_query_add_allocation_meta (query, GST_VIDEO_META_API_TYPE, NULL);
@@ -603,63 +2533,217 @@ gst_mpp_video_enc_propose_allocation (GstVideoEncoder * encoder,
   return TRUE;
 }
 
-static gboolean
-gst_mpp_video_enc_finish (GstVideoEncoder * encoder)
+/* Wait for the output thread to push all the frames in flight, called with
+ * the stream lock */
+GstFlowReturn
+gst_mpp_video_enc_drain (GstMppVideoEnc * self)
 {
-  GstMppVideoEnc *self = GST_MPP_VIDEO_ENC (encoder);
-  GstBuffer *buffer;
+  GstVideoEncoder *encoder = GST_VIDEO_ENCODER (self);
+  GstFlowReturn ret = GST_FLOW_OK;
 
-  if (!g_atomic_int_get (&self->processing))
+  if (gst_pad_get_task_state (encoder->srcpad) != GST_TASK_STARTED)
     goto done;
 
   GST_DEBUG_OBJECT (self, "Finishing encoding");
 
   GST_VIDEO_ENCODER_STREAM_UNLOCK (encoder);
 
-  /* Send a empty buffer to send eos frame to rockchip mpp */
-  buffer = gst_buffer_new ();
-  /* buffer would be release here */
-  gst_mpp_video_enc_process_buffer (self, buffer);
-
-  /* Wait the task in srcpad get eos package */
-  while (g_atomic_int_get (&self->processing));
+  /* Wait for the output thread to push all the frames in flight */
+  g_mutex_lock (&self->lock);
+  while (self->pending > 0 && !self->flushing
+      && self->output_flow == GST_FLOW_OK)
+    g_cond_wait (&self->cond, &self->lock);
+  if (self->flushing)
+    ret = GST_FLOW_FLUSHING;
+  else
+    ret = self->output_flow;
+  g_mutex_unlock (&self->lock);
 
-  gst_mpp_video_enc_process_buffer_stopped (self);
   GST_VIDEO_ENCODER_STREAM_LOCK (encoder);
 
   GST_DEBUG_OBJECT (encoder, "Done draning buffers");
 
 done:
-  return TRUE;
+  return ret;
+}
+
+static GstFlowReturn
+gst_mpp_video_enc_finish (GstVideoEncoder * encoder)
+{
+  return gst_mpp_video_enc_drain (GST_MPP_VIDEO_ENC (encoder));
+}
+
+static gboolean
+gst_mpp_video_enc_sink_event (GstVideoEncoder * encoder, GstEvent * event)
+{
+  GstMppVideoEnc *self = GST_MPP_VIDEO_ENC (encoder);
+  gboolean ret;
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_FLUSH_START:
+      GST_DEBUG_OBJECT (self, "flush start");
+      gst_mpp_video_enc_unlock (self);
+      break;
+    default:
+      break;
+  }
+
+  ret = GST_VIDEO_ENCODER_CLASS (parent_class)->sink_event (encoder, event);
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_FLUSH_START:
+      gst_pad_stop_task (encoder->srcpad);
+      GST_DEBUG_OBJECT (self, "flush done");
+      break;
+    default:
+      break;
+  }
+
+  return ret;
+}
+
+static GstStateChangeReturn
+gst_mpp_video_enc_change_state (GstElement * element, GstStateChange transition)
+{
+  GstVideoEncoder *encoder = GST_VIDEO_ENCODER (element);
+  GstMppVideoEnc *self = GST_MPP_VIDEO_ENC (encoder);
+
+  if (transition == GST_STATE_CHANGE_PAUSED_TO_READY) {
+    g_atomic_int_set (&self->active, FALSE);
+    gst_mpp_video_enc_unlock (self);
+    gst_pad_stop_task (encoder->srcpad);
+  }
+
+  return GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
+}
+
+static void
+gst_mpp_video_enc_finalize (GObject * object)
+{
+  GstMppVideoEnc *self = GST_MPP_VIDEO_ENC (object);
+
+  /* The pools are gone, they hold a reference on the element */
+  gst_mpp_object_destroy (self->mpp_input);
+  g_hash_table_unref (self->import_cache);
+  g_mutex_clear (&self->lock);
+  g_cond_clear (&self->cond);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
 static void
 gst_mpp_video_enc_init (GstMppVideoEnc * self)
 {
+  self->max_pending = DEFAULT_PROP_MAX_PENDING;
+  self->slice_mode = DEFAULT_PROP_SLICE_MODE;
+  self->slice_size = DEFAULT_PROP_SLICE_SIZE;
+  self->roi_qp_delta = DEFAULT_PROP_ROI_QP_DELTA;
+  self->bg_qp_delta = DEFAULT_PROP_BG_QP_DELTA;
+  self->realtime = DEFAULT_PROP_REALTIME;
+  self->rc_mode = DEFAULT_PROP_RC_MODE;
+  self->bitrate = DEFAULT_PROP_BITRATE;
+  self->max_bitrate = DEFAULT_PROP_MAX_BITRATE;
+  self->gop = DEFAULT_PROP_GOP;
+  self->qp_init = DEFAULT_PROP_QP;
+  self->qp_min = DEFAULT_PROP_QP;
+  self->qp_max = DEFAULT_PROP_QP;
+  self->vi_interval = DEFAULT_PROP_VI_INTERVAL;
+  self->mpp_input = gst_mpp_object_new (GST_ELEMENT (self), TRUE);
+  self->import_cache = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+      NULL, (GDestroyNotify) gst_mpp_video_enc_import_free);
+
+  g_mutex_init (&self->lock);
+  g_cond_init (&self->cond);
 }
 
 static void
 gst_mpp_video_enc_class_init (GstMppVideoEncClass * klass)
 {
+  GObjectClass *gobject_class;
   GstElementClass *element_class;
   GstVideoEncoderClass *video_encoder_class;
 
+  gobject_class = (GObjectClass *) klass;
   element_class = (GstElementClass *) klass;
   video_encoder_class = (GstVideoEncoderClass *) klass;
 
   GST_DEBUG_CATEGORY_INIT (mppvideoenc_debug, "mppvideoenc", 0,
       "Rockchip MPP Video Encoder");
 
+  gobject_class->set_property =
+      GST_DEBUG_FUNCPTR (gst_mpp_video_enc_set_property);
+  gobject_class->get_property =
+      GST_DEBUG_FUNCPTR (gst_mpp_video_enc_get_property);
+  gobject_class->finalize = GST_DEBUG_FUNCPTR (gst_mpp_video_enc_finalize);
+
+  g_object_class_install_property (gobject_class, PROP_MAX_PENDING,
+      g_param_spec_uint ("max-pending", "Max pending",
+          "Maximum number of frames in flight in the encoder",
+          1, MPP_MAX_BUFFERS, DEFAULT_PROP_MAX_PENDING,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_SLICE_MODE,
+      g_param_spec_enum ("slice-mode", "Slice mode",
+          "How the frames are split into slices, with alignment=nal each "
+          "slice is a buffer. They are pushed as MPP encodes them when it has "
+          "a low delay output, otherwise along with their frame",
+          GST_TYPE_MPP_ENC_SLICE_MODE, DEFAULT_PROP_SLICE_MODE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_SLICE_SIZE,
+      g_param_spec_uint ("slice-size", "Slice size",
+          "Size of the slices, in bytes or in macroblock rows (H.264 only)",
+          0, G_MAXINT, DEFAULT_PROP_SLICE_SIZE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_ROI_QP_DELTA,
+      g_param_spec_int ("roi-qp-delta", "ROI QP delta",
+          "QP offset of the regions of interest. With 0 they keep the frame "
+          "QP, only sparing them the bg-qp-delta",
+          -51, 51, DEFAULT_PROP_ROI_QP_DELTA,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING));
+
+  g_object_class_install_property (gobject_class, PROP_BG_QP_DELTA,
+      g_param_spec_int ("bg-qp-delta", "Background QP delta",
+          "QP offset outside the regions of interest of a frame",
+          -51, 51, DEFAULT_PROP_BG_QP_DELTA,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING));
+
+  g_object_class_install_property (gobject_class, PROP_REALTIME,
+      g_param_spec_boolean ("realtime", "Realtime",
+          "Drop the frames which waited longer than the frames in flight "
+          "take to encode, instead of letting the latency grow",
+          DEFAULT_PROP_REALTIME,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING));
+
+  g_object_class_install_property (gobject_class, PROP_STATS,
+      g_param_spec_boxed ("stats", "Statistics",
+          "Statistics of the frames encoded since the start: frames, "
+          "dropped-frames, intra-frames, bytes, average-qp, average-encode-time and "
+          "max-encode-time, the times are wall-clock approximations of the "
+          "hardware time which include the queueing in MPP",
+          GST_TYPE_STRUCTURE,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  element_class->change_state =
+      GST_DEBUG_FUNCPTR (gst_mpp_video_enc_change_state);
+
   video_encoder_class->close = GST_DEBUG_FUNCPTR (gst_mpp_video_enc_close);
   video_encoder_class->start = GST_DEBUG_FUNCPTR (gst_mpp_video_enc_start);
   video_encoder_class->stop = GST_DEBUG_FUNCPTR (gst_mpp_video_enc_stop);
   video_encoder_class->flush = GST_DEBUG_FUNCPTR (gst_mpp_video_enc_flush);
   video_encoder_class->finish = GST_DEBUG_FUNCPTR (gst_mpp_video_enc_finish);
+  video_encoder_class->sink_event =
+      GST_DEBUG_FUNCPTR (gst_mpp_video_enc_sink_event);
   video_encoder_class->propose_allocation =
       GST_DEBUG_FUNCPTR (gst_mpp_video_enc_propose_allocation);
   klass->handle_frame = GST_DEBUG_FUNCPTR (gst_mpp_video_enc_handle_frame);
   klass->set_format = GST_DEBUG_FUNCPTR (gst_mpp_video_enc_set_format);
 
-  gst_element_class_add_pad_template (element_class,
-      gst_static_pad_template_get (&gst_mpp_video_enc_sink_template));
 }
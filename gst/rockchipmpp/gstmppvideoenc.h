@@ -30,6 +30,11 @@
 
 #include <rockchip/rk_mpi.h>
 
+#include "gstmppobject.h"
+#include "gstmpproi.h"
+#include "gstmppconvert.h"
+#include "gstmppencmeta.h"
+
 GST_DEBUG_CATEGORY_EXTERN (mppvideoenc_debug);
 
 /* Begin Declaration */
@@ -45,10 +50,86 @@ G_BEGIN_DECLS
 	(G_TYPE_CHECK_CLASS_TYPE((klass), GST_TYPE_MPP_VIDEO_ENC))
 typedef struct _GstMppVideoEnc GstMppVideoEnc;
 typedef struct _GstMppVideoEncClass GstMppVideoEncClass;
+typedef struct _GstMppVideoEncSlot GstMppVideoEncSlot;
+
+#define GST_TYPE_MPP_ENC_RC_MODE (gst_mpp_enc_rc_mode_get_type ())
+
+typedef enum
+{
+  GST_MPP_ENC_RC_MODE_CBR = 0,
+  GST_MPP_ENC_RC_MODE_VBR = 1,
+  /* Constant QP */
+  GST_MPP_ENC_RC_MODE_CQP = 2,
+  /* VBR never going over the target bitrate */
+  GST_MPP_ENC_RC_MODE_AVBR = 3,
+} GstMppEncRcMode;
+
+#define MPP_ENC_RC_PROPS \
+	PROP_RC_MODE, \
+	PROP_BITRATE, \
+	PROP_MAX_BITRATE, \
+	PROP_GOP, \
+	PROP_QP_INIT, \
+	PROP_QP_MIN, \
+	PROP_QP_MAX, \
+	PROP_VI_INTERVAL
+
+/* QP of the rate control, for the codec configuration */
+typedef struct
+{
+  gint init;
+  gint min;
+  gint max;
+  gint max_step;
+} GstMppVideoEncQp;
 
-#define MPP_MAX_BUFFERS                 4
+#define GST_TYPE_MPP_ENC_SLICE_MODE (gst_mpp_enc_slice_mode_get_type ())
+
+typedef enum
+{
+  GST_MPP_ENC_SLICE_MODE_NONE = 0,
+  /* Slices of at most slice-size bytes */
+  GST_MPP_ENC_SLICE_MODE_BYTES = 1,
+  /* Slices of slice-size macroblock rows */
+  GST_MPP_ENC_SLICE_MODE_MB_ROWS = 2,
+} GstMppEncSliceMode;
+
+/* The NALs of a frame can only go through the base class one by one since
+ * GStreamer 1.18, before it the frames are pushed whole */
+#if GST_CHECK_VERSION (1, 18, 0)
+#define GST_MPP_VIDEO_ENC_SUBFRAMES 1
+#define GST_MPP_VIDEO_ENC_ALIGNMENTS "{ au, nal }"
+#else
+#define GST_MPP_VIDEO_ENC_ALIGNMENTS "au"
+#endif
+
+#define MPP_MAX_BUFFERS                 8
 #define MAX_CODEC_FRAME                 (1<<16)
-#define MAX_EXTRA_DATA                  (1<<9)
+#define MPP_MAX_ROI_REGIONS             8
+
+/* A frame submitted to the encoder */
+struct _GstMppVideoEncSlot
+{
+  MppBuffer input_buffer;
+  MppBuffer output_buffer;
+  MppFrame mpp_frame;
+  MppPacket packet;
+  guint32 frame_number;
+  /* Monotonic time the frame was given to MPP */
+  gint64 submit_time;
+  /* An IDR was requested for this frame */
+  gboolean force_idr;
+
+  /* Imported frame, kept until it is encoded */
+  GstBuffer *inbuf;
+  MppBuffer import_buffer;
+
+#ifdef HAVE_MPP_ENC_ROI
+  /* Regions of interest of the frame, read by MPP along with it */
+  MppEncROICfg roi_cfg;
+  MppEncROIRegion roi_regions[MPP_MAX_ROI_REGIONS];
+#endif
+};
 
 struct _GstMppVideoEnc
 {
@@ -60,22 +141,97 @@ struct _GstMppVideoEnc
   /* Buffer */
   MppBufferGroup input_group;
   MppBufferGroup output_group;
-  MppBuffer input_buffer[MPP_MAX_BUFFERS];
-  MppBuffer output_buffer[MPP_MAX_BUFFERS];
-  MppFrame mpp_frame;
+  MppBufferGroup import_group;
+  GHashTable *import_cache;
+  /* Pool proposed to upstream */
+  GstMppObject *mpp_input;
   MppPacket sps_packet;
+  /* Stream headers, shared by every intra frame */
+  GstMemory *header_mem;
   GstCaps *outcaps;
+  /* NALs are prefixed by their size instead of start codes (avc, hvc1) */
+  gboolean length_prefixed;
+  /* Each NAL is pushed in its own buffer */
+  gboolean nal_aligned;
+  GstMppEncSliceMode slice_mode;
+  guint slice_size;
+  /* MPP hands the slices out as they are encoded, through put_frame and
+   * get_packet instead of the tasks. A context keeps to the interface of
+   * its first frame, io_started tells that it was picked. */
+  gboolean low_delay;
+  gboolean io_started;
+
+  /* Rate control, applied again at the next frame once dirty */
+  GstMppEncRcMode rc_mode;
+  guint bitrate;
+  guint max_bitrate;
+  guint gop;
+  gint qp_init;
+  gint qp_min;
+  gint qp_max;
+  gboolean rc_dirty;
+  /* No periodic IDR, the stream refreshes itself some other way */
+  gboolean idr_on_request;
+  /* Frames of an intra refresh cycle, 0 without. The stream headers and
+   * refresh_mem go in front of the first frame of each cycle, which still
+   * is a delta unit. */
+  guint refresh_period;
+  GstMemory *refresh_mem;
+  /* Frames output since the current cycle started */
+  guint refresh_count;
+  /* Smart P, the virtual intra frames MPP is configured with */
+  guint vi_interval;
+  guint ref_vi_interval;
+  guint ref_gop;
+
+  /* QP offsets of the regions of interest and of the rest of the frame */
+  gint roi_qp_delta;
+  gint bg_qp_delta;
+
+  /* Drop the frames arriving too late to be encoded in time */
+  gboolean realtime;
 
-  /* the currently format */
+  /* Statistics of the encoded frames, under the object lock */
+  guint64 stats_frames;
+  guint64 stats_dropped;
+  guint64 stats_intra_frames;
+  guint64 stats_bytes;
+  guint64 stats_qp_sum;
+  guint64 stats_qp_frames;
+  GstClockTime stats_encode_time;
+  GstClockTime stats_max_encode_time;
+  /* Monotonic time the previous frame came out of MPP */
+  gint64 last_output_time;
+
+  /* the currently format, layout of the internal input buffers */
   GstVideoInfo info;
+  guint ver_stride;
+  gsize packet_size;
+  /* Size of the input buffers of the slots, reallocated to grow */
+  gsize input_size;
+  /* layout the frames are copied in, NV12 when they are converted */
+  GstVideoInfo copy_info;
+  GstMppConvertFunc convert;
+  /* Format and strides MPP is configured with, following the frames */
+  MppFrameFormat prep_format;
+  guint prep_hor_stride;
+  guint prep_ver_stride;
 
   /* pads */
   GstCaps *probed_srccaps;
   GstCaps *probed_sinkcaps;
 
+  /* Frames in flight, the oldest one is pending slots before head */
+  GstMppVideoEncSlot slots[MPP_MAX_BUFFERS];
+  guint max_pending;
+  guint head;
+  guint pending;
+  GMutex lock;
+  GCond cond;
+  gboolean flushing;
+
   /* State */
   GstVideoCodecState *input_state;
-  gboolean processing;
   gboolean active;
   GstFlowReturn output_flow;
 };
@@ -90,6 +246,26 @@ struct _GstMppVideoEncClass
 };
 
 GType gst_mpp_video_enc_get_type (void);
+GType gst_mpp_enc_rc_mode_get_type (void);
+GType gst_mpp_enc_slice_mode_get_type (void);
+
+void gst_mpp_video_enc_get_max_size (MppCodingType coding, gint * max_width,
+    gint * max_height);
+void gst_mpp_video_enc_add_pad_templates (GstElementClass * element_class,
+    MppCodingType coding, GstCaps * src_caps);
+
+void gst_mpp_video_enc_install_rc_properties (GObjectClass * gobject_class);
+gboolean gst_mpp_video_enc_rc_set_property (GstMppVideoEnc * self,
+    guint prop_id, const GValue * value, GParamSpec * pspec);
+gboolean gst_mpp_video_enc_rc_get_property (GstMppVideoEnc * self,
+    guint prop_id, GValue * value, GParamSpec * pspec);
+GstFlowReturn gst_mpp_video_enc_drain (GstMppVideoEnc * self);
+
+gboolean gst_mpp_video_enc_set_rc_cfg (GstMppVideoEnc * self,
+    GstVideoInfo * info, GstMppVideoEncQp * qp);
+
+gboolean gst_mpp_video_enc_next_nal (const guint8 * data, gsize size,
+    gsize * offset, gsize * nal_size);
 
 
 G_END_DECLS
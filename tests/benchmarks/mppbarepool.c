@@ -0,0 +1,103 @@
+/*
+ * Copyright 2018 Rockchip Electronics Co., Ltd
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Cost of an acquire/release cycle of the output pool of mppjpegdec,
+ * compared with the default GstBufferPool of the same geometry */
+
+#include <stdlib.h>
+#include <gst/gst.h>
+
+#include "gstmppbarebufferpool.h"
+
+#define DEFAULT_ITERATIONS 100000
+#define N_BUFFERS 4
+
+static gboolean
+configure_pool (GstBufferPool * pool, guint size)
+{
+  GstStructure *config;
+
+  config = gst_buffer_pool_get_config (pool);
+  gst_buffer_pool_config_set_params (config, NULL, size, N_BUFFERS,
+      N_BUFFERS);
+  if (!gst_buffer_pool_set_config (pool, config))
+    return FALSE;
+
+  return gst_buffer_pool_set_active (pool, TRUE);
+}
+
+static gdouble
+run (GstBufferPool * pool, guint iterations)
+{
+  GstBuffer *bufs[N_BUFFERS];
+  gint64 start, end;
+  guint i, j;
+
+  start = g_get_monotonic_time ();
+  for (i = 0; i < iterations; i++) {
+    /* Hold several buffers at once as the decoder does with its contexts */
+    for (j = 0; j < N_BUFFERS; j++) {
+      if (gst_buffer_pool_acquire_buffer (pool, &bufs[j], NULL) != GST_FLOW_OK)
+        g_error ("failed to acquire buffer %u", j);
+    }
+    for (j = 0; j < N_BUFFERS; j++)
+      gst_buffer_unref (bufs[j]);
+  }
+  end = g_get_monotonic_time ();
+
+  /* ns per acquire + release */
+  return (end - start) * 1000.0 / ((gdouble) iterations * N_BUFFERS);
+}
+
+gint
+main (gint argc, gchar * argv[])
+{
+  GstMppJpegDec *dec;
+  GstBufferPool *pool;
+  guint iterations = DEFAULT_ITERATIONS;
+  guint size;
+
+  gst_init (&argc, &argv);
+
+  if (argc > 1)
+    iterations = atoi (argv[1]);
+
+  dec = g_object_new (GST_TYPE_MPP_JPEG_DEC, NULL);
+  gst_object_ref_sink (dec);
+  gst_video_info_set_format (&dec->info, GST_VIDEO_FORMAT_NV12, 1920, 1088);
+  size = GST_VIDEO_INFO_SIZE (&dec->info);
+
+  pool = gst_buffer_pool_new ();
+  if (!configure_pool (pool, size))
+    g_error ("failed to start the default pool");
+  g_print ("default pool:  %8.1f ns per buffer\n", run (pool, iterations));
+  gst_buffer_pool_set_active (pool, FALSE);
+  gst_object_unref (pool);
+
+  pool = gst_mpp_bare_buffer_pool_new (dec, NULL);
+  if (!pool || !configure_pool (pool, size))
+    g_error ("failed to start the mpp bare pool");
+  g_print ("mpp bare pool: %8.1f ns per buffer\n", run (pool, iterations));
+  gst_buffer_pool_set_active (pool, FALSE);
+  gst_object_unref (pool);
+
+  gst_object_unref (dec);
+
+  return 0;
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright 2018 Rockchip Electronics Co., Ltd
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Throughput of the encoder input conversions, in MB of source frames per
+ * second, with their NEON loops and with the scalar code alone, next to a
+ * plain copy of the same frames. The encoder only converts YUY2, the other
+ * kernels show what a conversion would cost there.
+ *
+ * Usage: mppconvert [width height [iterations]]
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+#include "gstmppconvert.h"
+
+/* From mppconvertscalar.c */
+GstMppConvertFunc gst_mpp_convert_get_scalar_func (GstVideoFormat format);
+
+#define DEFAULT_WIDTH 1920
+#define DEFAULT_HEIGHT 1080
+#define DEFAULT_ITERATIONS 200
+
+static const GstVideoFormat formats[] = {
+  GST_VIDEO_FORMAT_YUY2, GST_VIDEO_FORMAT_I420, GST_VIDEO_FORMAT_BGRx,
+};
+
+/* The copy of a frame in its own format */
+static void
+copy (GstVideoFrame * src, guint8 * dst, gint stride, gint ver_stride)
+{
+  memcpy (dst, GST_VIDEO_FRAME_PLANE_DATA (src, 0), GST_VIDEO_FRAME_SIZE (src));
+}
+
+static gdouble
+run (GstMppConvertFunc convert, GstVideoFrame * src, guint8 * dst,
+    gint stride, gint ver_stride, guint iterations)
+{
+  gint64 start, end;
+  guint i;
+
+  start = g_get_monotonic_time ();
+  for (i = 0; i < iterations; i++)
+    convert (src, dst, stride, ver_stride);
+  end = g_get_monotonic_time ();
+
+  /* bytes per us is MB/s */
+  return GST_VIDEO_FRAME_SIZE (src) * (gdouble) iterations / (end - start);
+}
+
+gint
+main (gint argc, gchar * argv[])
+{
+  gint width = DEFAULT_WIDTH, height = DEFAULT_HEIGHT;
+  guint iterations = DEFAULT_ITERATIONS;
+  gint stride, ver_stride;
+  guint8 *dst;
+  guint i;
+
+  gst_init (&argc, &argv);
+
+  if (argc > 2) {
+    width = atoi (argv[1]);
+    height = atoi (argv[2]);
+  }
+  if (argc > 3)
+    iterations = atoi (argv[3]);
+
+  stride = GST_ROUND_UP_16 (width);
+  ver_stride = GST_ROUND_UP_16 (height);
+  /* Large enough for a copy of any of the formats too */
+  dst = g_malloc (stride * ver_stride * 4);
+
+  g_print ("%dx%d, %u iterations\n", width, height, iterations);
+  g_print ("format  kernel MB/s  scalar MB/s  speedup  copy MB/s\n");
+  for (i = 0; i < G_N_ELEMENTS (formats); i++) {
+    GstVideoInfo info;
+    GstVideoFrame src;
+    GstBuffer *buffer;
+    gdouble kernel, scalar, plain;
+
+    gst_video_info_set_format (&info, formats[i], width, height);
+    buffer = gst_buffer_new_allocate (NULL, GST_VIDEO_INFO_SIZE (&info), NULL);
+    gst_buffer_memset (buffer, 0, 0x80, GST_VIDEO_INFO_SIZE (&info));
+    if (!gst_video_frame_map (&src, &info, buffer, GST_MAP_READ))
+      g_error ("failed to map a %s frame",
+          gst_video_format_to_string (formats[i]));
+
+    kernel = run (gst_mpp_convert_get_func (formats[i]), &src, dst, stride,
+        ver_stride, iterations);
+    scalar = run (gst_mpp_convert_get_scalar_func (formats[i]), &src, dst,
+        stride, ver_stride, iterations);
+    plain = run (copy, &src, dst, stride, ver_stride, iterations);
+    g_print ("%-6s  %11.1f  %11.1f  %6.2fx  %9.1f\n",
+        gst_video_format_to_string (formats[i]), kernel, scalar,
+        kernel / scalar, plain);
+
+    gst_video_frame_unmap (&src);
+    gst_buffer_unref (buffer);
+  }
+
+  g_free (dst);
+
+  return 0;
+}
@@ -0,0 +1,159 @@
+/*
+ * Copyright 2018 Rockchip Electronics Co., Ltd
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Scaling of the encoder with the number of instances in one process: the
+ * open/close cycles per second, then the frames encoded per second by all
+ * the instances together.
+ *
+ * Usage: mppencinstances [encoder [width height]]
+ */
+
+#include <stdlib.h>
+#include <gst/gst.h>
+
+#define MAX_INSTANCES 8
+#define N_CYCLES 100
+#define N_FRAMES 300
+
+typedef struct
+{
+  const gchar *name;
+  gint width;
+  gint height;
+  gboolean ok;
+} Instance;
+
+static gpointer
+open_close_thread (gpointer data)
+{
+  Instance *inst = data;
+  GstElement *enc;
+  guint i;
+
+  inst->ok = FALSE;
+  enc = gst_element_factory_make (inst->name, NULL);
+  if (!enc)
+    return NULL;
+
+  for (i = 0; i < N_CYCLES; i++) {
+    if (gst_element_set_state (enc, GST_STATE_READY) !=
+        GST_STATE_CHANGE_SUCCESS)
+      break;
+    gst_element_set_state (enc, GST_STATE_NULL);
+  }
+  inst->ok = (i == N_CYCLES);
+
+  gst_object_unref (enc);
+
+  return NULL;
+}
+
+static gpointer
+encode_thread (gpointer data)
+{
+  Instance *inst = data;
+  GstElement *pipeline;
+  GstMessage *msg;
+  gchar *desc;
+
+  inst->ok = FALSE;
+  desc = g_strdup_printf ("videotestsrc num-buffers=%d ! "
+      "video/x-raw,format=NV12,width=%d,height=%d,framerate=30/1 ! "
+      "%s ! fakesink sync=false", N_FRAMES, inst->width, inst->height,
+      inst->name);
+  pipeline = gst_parse_launch (desc, NULL);
+  g_free (desc);
+  if (!pipeline)
+    return NULL;
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  msg = gst_bus_timed_pop_filtered (GST_ELEMENT_BUS (pipeline),
+      GST_CLOCK_TIME_NONE, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  inst->ok = (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_EOS);
+  gst_message_unref (msg);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+
+  return NULL;
+}
+
+/* Run n instances of func at once, returns the elapsed seconds */
+static gdouble
+run (GThreadFunc func, Instance * insts, guint n)
+{
+  GThread *threads[MAX_INSTANCES];
+  gint64 start;
+  guint i;
+
+  start = g_get_monotonic_time ();
+  for (i = 0; i < n; i++)
+    threads[i] = g_thread_new (NULL, func, &insts[i]);
+  for (i = 0; i < n; i++)
+    g_thread_join (threads[i]);
+
+  for (i = 0; i < n; i++) {
+    if (!insts[i].ok)
+      return -1;
+  }
+
+  return (g_get_monotonic_time () - start) / (gdouble) G_USEC_PER_SEC;
+}
+
+gint
+main (gint argc, gchar * argv[])
+{
+  Instance insts[MAX_INSTANCES];
+  const gchar *name = "mpph264enc";
+  gint width = 1280, height = 720;
+  guint n, i;
+
+  gst_init (&argc, &argv);
+
+  if (argc > 1)
+    name = argv[1];
+  if (argc > 3) {
+    width = atoi (argv[2]);
+    height = atoi (argv[3]);
+  }
+
+  for (i = 0; i < MAX_INSTANCES; i++) {
+    insts[i].name = name;
+    insts[i].width = width;
+    insts[i].height = height;
+  }
+
+  g_print ("%s, %dx%d\n", name, width, height);
+  g_print ("instances  open/close/s  frames/s\n");
+  for (n = 1; n <= MAX_INSTANCES; n *= 2) {
+    gdouble cycles, frames;
+
+    cycles = run (open_close_thread, insts, n);
+    frames = run (encode_thread, insts, n);
+    if (cycles < 0 || frames < 0) {
+      g_printerr ("running %u instances failed\n", n);
+      return 1;
+    }
+
+    g_print ("%9u  %12.1f  %8.1f\n", n, n * N_CYCLES / cycles,
+        n * N_FRAMES / frames);
+  }
+
+  return 0;
+}
@@ -0,0 +1,205 @@
+/*
+ * Copyright 2018 Rockchip Electronics Co., Ltd
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Frames per second and output size of mpph264enc and mpph265enc on the
+ * same frames, at the same fixed QP. The frames are rendered once and
+ * pushed from memory, so that only the encoders are measured.
+ *
+ * Usage: mpphevcavc [qp [width height [n-frames]]]
+ */
+
+#include <stdlib.h>
+#include <gst/gst.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/app/gstappsink.h>
+
+#define DEFAULT_QP 30
+#define DEFAULT_WIDTH 1920
+#define DEFAULT_HEIGHT 1080
+#define DEFAULT_N_FRAMES 300
+/* Distinct frames, pushed over and over */
+#define N_SOURCE_FRAMES 60
+
+static const gchar *encoders[] = { "mpph264enc", "mpph265enc" };
+
+static GPtrArray *
+render_frames (gint width, gint height, GstCaps ** caps)
+{
+  GstElement *pipeline, *sink;
+  GstSample *sample;
+  GPtrArray *frames;
+  gchar *desc;
+
+  desc = g_strdup_printf ("videotestsrc num-buffers=%d pattern=ball "
+      "background-color=0xff4080c0 ! video/x-raw,format=NV12,width=%d,"
+      "height=%d,framerate=30/1 ! appsink name=sink sync=false",
+      N_SOURCE_FRAMES, width, height);
+  pipeline = gst_parse_launch (desc, NULL);
+  g_free (desc);
+  if (!pipeline)
+    return NULL;
+
+  sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  frames = g_ptr_array_new_with_free_func ((GDestroyNotify) gst_buffer_unref);
+  *caps = NULL;
+  while ((sample = gst_app_sink_pull_sample (GST_APP_SINK (sink)))) {
+    if (!*caps)
+      *caps = gst_caps_copy (gst_sample_get_caps (sample));
+    g_ptr_array_add (frames, gst_buffer_ref (gst_sample_get_buffer (sample)));
+    gst_sample_unref (sample);
+  }
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (sink);
+  gst_object_unref (pipeline);
+
+  return frames;
+}
+
+typedef struct
+{
+  GstAppSrc *src;
+  GPtrArray *frames;
+  guint n_frames;
+} Feeder;
+
+static gpointer
+feed_thread (gpointer data)
+{
+  Feeder *feeder = data;
+  GstBuffer *buffer;
+  guint i;
+
+  for (i = 0; i < feeder->n_frames; i++) {
+    /* Shares the memory of the rendered frame */
+    buffer = gst_buffer_copy (g_ptr_array_index (feeder->frames,
+            i % feeder->frames->len));
+    GST_BUFFER_PTS (buffer) = gst_util_uint64_scale (i, GST_SECOND, 30);
+    GST_BUFFER_DTS (buffer) = GST_CLOCK_TIME_NONE;
+    GST_BUFFER_DURATION (buffer) = GST_SECOND / 30;
+    if (gst_app_src_push_buffer (feeder->src, buffer) != GST_FLOW_OK)
+      break;
+  }
+  gst_app_src_end_of_stream (feeder->src);
+
+  return NULL;
+}
+
+/* Returns the frames per second, 0 on error, and the bytes produced */
+static gdouble
+encode (const gchar * name, GPtrArray * frames, GstCaps * caps,
+    guint n_frames, gint qp, guint64 * bytes)
+{
+  GstElement *pipeline, *src, *sink;
+  GstSample *sample;
+  GThread *thread;
+  Feeder feeder;
+  gint64 start, end;
+  guint n = 0;
+  gchar *desc;
+
+  desc = g_strdup_printf ("appsrc name=src format=time ! %s rc-mode=cqp "
+      "qp-init=%d ! appsink name=sink sync=false", name, qp);
+  pipeline = gst_parse_launch (desc, NULL);
+  g_free (desc);
+  if (!pipeline)
+    return 0;
+
+  src = gst_bin_get_by_name (GST_BIN (pipeline), "src");
+  sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+  gst_app_src_set_caps (GST_APP_SRC (src), caps);
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  feeder.src = GST_APP_SRC (src);
+  feeder.frames = frames;
+  feeder.n_frames = n_frames;
+
+  *bytes = 0;
+  start = g_get_monotonic_time ();
+  thread = g_thread_new (NULL, feed_thread, &feeder);
+  while ((sample = gst_app_sink_pull_sample (GST_APP_SINK (sink)))) {
+    *bytes += gst_buffer_get_size (gst_sample_get_buffer (sample));
+    gst_sample_unref (sample);
+    n++;
+  }
+  end = g_get_monotonic_time ();
+  g_thread_join (thread);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (sink);
+  gst_object_unref (src);
+  gst_object_unref (pipeline);
+
+  if (n != n_frames)
+    return 0;
+
+  return n * G_USEC_PER_SEC / (gdouble) (end - start);
+}
+
+gint
+main (gint argc, gchar * argv[])
+{
+  gint width = DEFAULT_WIDTH, height = DEFAULT_HEIGHT, qp = DEFAULT_QP;
+  guint n_frames = DEFAULT_N_FRAMES;
+  guint64 bytes, avc_bytes = 0;
+  GPtrArray *frames;
+  GstCaps *caps;
+  gdouble fps;
+  guint i;
+
+  gst_init (&argc, &argv);
+
+  if (argc > 1)
+    qp = atoi (argv[1]);
+  if (argc > 3) {
+    width = atoi (argv[2]);
+    height = atoi (argv[3]);
+  }
+  if (argc > 4)
+    n_frames = atoi (argv[4]);
+
+  frames = render_frames (width, height, &caps);
+  if (!frames || !caps) {
+    g_printerr ("failed to render the frames\n");
+    return 1;
+  }
+
+  g_print ("%u frames of %dx%d, qp %d\n", n_frames, width, height, qp);
+  g_print ("encoder         fps       bytes      kbps  size\n");
+  for (i = 0; i < G_N_ELEMENTS (encoders); i++) {
+    fps = encode (encoders[i], frames, caps, n_frames, qp, &bytes);
+    if (fps == 0) {
+      g_printerr ("encoding with %s failed\n", encoders[i]);
+      return 1;
+    }
+    if (i == 0)
+      avc_bytes = bytes;
+
+    g_print ("%-10s  %7.1f  %10" G_GUINT64_FORMAT "  %8.1f  %3.0f%%\n",
+        encoders[i], fps, bytes, bytes * 8 * 30 / 1000.0 / n_frames,
+        bytes * 100.0 / avc_bytes);
+  }
+
+  g_ptr_array_unref (frames);
+  gst_caps_unref (caps);
+
+  return 0;
+}
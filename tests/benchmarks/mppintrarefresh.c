@@ -0,0 +1,147 @@
+/*
+ * Copyright 2018 Rockchip Electronics Co., Ltd
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Spread of the frame sizes of mpph264enc with periodic IDRs and with an
+ * intra refresh over the same number of frames, at the same bitrate. The
+ * largest frame bounds the latency of a constant bitrate link.
+ *
+ * Usage: mppintrarefresh [period [width height [n-frames]]]
+ */
+
+#include <stdlib.h>
+#include <math.h>
+#include <gst/gst.h>
+#include <gst/app/gstappsink.h>
+
+#define DEFAULT_PERIOD 30
+#define DEFAULT_WIDTH 1280
+#define DEFAULT_HEIGHT 720
+#define DEFAULT_N_FRAMES 600
+
+typedef struct
+{
+  guint frames;
+  gdouble mean;
+  gdouble stddev;
+  gsize max;
+} Sizes;
+
+static gboolean
+encode (const gchar * settings, gint width, gint height, guint n_frames,
+    Sizes * sizes)
+{
+  GstElement *pipeline, *sink;
+  GstSample *sample;
+  gdouble sum = 0, sum_sq = 0;
+  gchar *desc;
+  gsize size;
+
+  /* A moving pattern, so that the P frames aren't empty */
+  desc = g_strdup_printf ("videotestsrc num-buffers=%u pattern=ball "
+      "background-color=0xff4080c0 ! video/x-raw,format=NV12,width=%d,"
+      "height=%d,framerate=30/1 ! mpph264enc rc-mode=cbr %s ! "
+      "video/x-h264,stream-format=byte-stream,alignment=au ! "
+      "appsink name=sink sync=false", n_frames, width, height, settings);
+  pipeline = gst_parse_launch (desc, NULL);
+  g_free (desc);
+  if (!pipeline)
+    return FALSE;
+
+  sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  sizes->frames = 0;
+  sizes->max = 0;
+  while ((sample = gst_app_sink_pull_sample (GST_APP_SINK (sink)))) {
+    size = gst_buffer_get_size (gst_sample_get_buffer (sample));
+    gst_sample_unref (sample);
+
+    sizes->frames++;
+    sizes->max = MAX (sizes->max, size);
+    sum += size;
+    sum_sq += (gdouble) size *size;
+  }
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (sink);
+  gst_object_unref (pipeline);
+
+  if (sizes->frames == 0)
+    return FALSE;
+
+  sizes->mean = sum / sizes->frames;
+  sizes->stddev = sqrt (MAX (sum_sq / sizes->frames -
+          sizes->mean * sizes->mean, 0));
+
+  return TRUE;
+}
+
+static void
+print_sizes (const gchar * name, const Sizes * sizes)
+{
+  g_print ("%-14s  %6u  %9.0f  %9.0f  %6.3f  %9" G_GSIZE_FORMAT "  %7.2f\n",
+      name, sizes->frames, sizes->mean, sizes->stddev,
+      sizes->stddev / sizes->mean, sizes->max, sizes->max / sizes->mean);
+}
+
+gint
+main (gint argc, gchar * argv[])
+{
+  gint width = DEFAULT_WIDTH, height = DEFAULT_HEIGHT;
+  guint period = DEFAULT_PERIOD, n_frames = DEFAULT_N_FRAMES;
+  Sizes gop, refresh;
+  gchar *settings;
+  gboolean ok;
+
+  gst_init (&argc, &argv);
+
+  if (argc > 1)
+    period = atoi (argv[1]);
+  if (argc > 3) {
+    width = atoi (argv[2]);
+    height = atoi (argv[3]);
+  }
+  if (argc > 4)
+    n_frames = atoi (argv[4]);
+
+  settings = g_strdup_printf ("gop=%u", period);
+  ok = encode (settings, width, height, n_frames, &gop);
+  g_free (settings);
+  if (!ok) {
+    g_printerr ("encoding with periodic IDRs failed\n");
+    return 1;
+  }
+
+  settings = g_strdup_printf ("intra-refresh=%u", period);
+  ok = encode (settings, width, height, n_frames, &refresh);
+  g_free (settings);
+  if (!ok) {
+    g_printerr ("encoding with intra refresh failed\n");
+    return 1;
+  }
+
+  g_print ("%dx%d, a refresh every %u frames, sizes in bytes\n", width,
+      height, period);
+  g_print ("mode            frames       mean     stddev      cv        max"
+      "  max/mean\n");
+  print_sizes ("periodic IDR", &gop);
+  print_sizes ("intra refresh", &refresh);
+
+  return 0;
+}
@@ -0,0 +1,158 @@
+/*
+ * Copyright 2018 Rockchip Electronics Co., Ltd
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Images decoded per second by mppjpegdec for each value of its "contexts"
+ * property. The images are encoded once by jpegenc and pushed from memory,
+ * so only the decoder is measured.
+ *
+ * Usage: mppjpegdec [width height [n-images]]
+ */
+
+#include <stdlib.h>
+#include <gst/gst.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/app/gstappsink.h>
+
+#define DEFAULT_WIDTH 1920
+#define DEFAULT_HEIGHT 1080
+#define DEFAULT_N_IMAGES 300
+#define MAX_CONTEXTS 8
+
+static GList *
+encode_images (gint width, gint height, guint n_images, GstCaps ** caps)
+{
+  GstElement *pipeline, *sink;
+  GstSample *sample;
+  GList *images = NULL;
+  gchar *desc;
+
+  desc = g_strdup_printf ("videotestsrc num-buffers=%u pattern=smpte ! "
+      "video/x-raw,format=I420,width=%d,height=%d ! jpegenc ! "
+      "appsink name=sink sync=false", n_images, width, height);
+  pipeline = gst_parse_launch (desc, NULL);
+  g_free (desc);
+  if (!pipeline)
+    return NULL;
+
+  sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  *caps = NULL;
+  while ((sample = gst_app_sink_pull_sample (GST_APP_SINK (sink)))) {
+    if (!*caps)
+      *caps = gst_caps_copy (gst_sample_get_caps (sample));
+    images = g_list_prepend (images,
+        gst_buffer_ref (gst_sample_get_buffer (sample)));
+    gst_sample_unref (sample);
+  }
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (sink);
+  gst_object_unref (pipeline);
+
+  return g_list_reverse (images);
+}
+
+static gdouble
+decode_images (GList * images, GstCaps * caps, guint contexts)
+{
+  GstElement *pipeline, *src;
+  GstMessage *msg;
+  GList *l;
+  gint64 start, end;
+  gchar *desc;
+  guint n = 0;
+
+  desc = g_strdup_printf ("appsrc name=src format=time ! "
+      "mppjpegdec contexts=%u ! fakesink sync=false", contexts);
+  pipeline = gst_parse_launch (desc, NULL);
+  g_free (desc);
+  if (!pipeline)
+    return 0;
+
+  src = gst_bin_get_by_name (GST_BIN (pipeline), "src");
+  gst_app_src_set_caps (GST_APP_SRC (src), caps);
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  start = g_get_monotonic_time ();
+  for (l = images; l; l = l->next, n++)
+    gst_app_src_push_buffer (GST_APP_SRC (src), gst_buffer_ref (l->data));
+  gst_app_src_end_of_stream (GST_APP_SRC (src));
+
+  msg = gst_bus_timed_pop_filtered (GST_ELEMENT_BUS (pipeline),
+      GST_CLOCK_TIME_NONE, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  end = g_get_monotonic_time ();
+
+  if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR)
+    n = 0;
+  gst_message_unref (msg);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (src);
+  gst_object_unref (pipeline);
+
+  return n * G_USEC_PER_SEC / (gdouble) (end - start);
+}
+
+gint
+main (gint argc, gchar * argv[])
+{
+  GList *images;
+  GstCaps *caps;
+  gint width = DEFAULT_WIDTH, height = DEFAULT_HEIGHT;
+  guint n_images = DEFAULT_N_IMAGES;
+  guint contexts;
+  gdouble base = 0;
+
+  gst_init (&argc, &argv);
+
+  if (argc > 2) {
+    width = atoi (argv[1]);
+    height = atoi (argv[2]);
+  }
+  if (argc > 3)
+    n_images = atoi (argv[3]);
+
+  images = encode_images (width, height, n_images, &caps);
+  if (!images || !caps) {
+    g_printerr ("failed to encode the test images\n");
+    return 1;
+  }
+  caps = gst_caps_make_writable (caps);
+  gst_caps_set_simple (caps, "parsed", G_TYPE_BOOLEAN, TRUE, NULL);
+
+  g_print ("%u images of %dx%d\n", g_list_length (images), width, height);
+  g_print ("contexts  images/s  scaling\n");
+  for (contexts = 1; contexts <= MAX_CONTEXTS; contexts++) {
+    gdouble rate = decode_images (images, caps, contexts);
+
+    if (rate == 0) {
+      g_printerr ("decoding with %u contexts failed\n", contexts);
+      break;
+    }
+    if (contexts == 1)
+      base = rate;
+    g_print ("%8u  %8.1f  %6.2fx\n", contexts, rate, rate / base);
+  }
+
+  g_list_free_full (images, (GDestroyNotify) gst_buffer_unref);
+  gst_caps_unref (caps);
+
+  return 0;
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright 2018 Rockchip Electronics Co., Ltd
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Size of a static scene encoded by mpph264enc with a random access point
+ * every interval frames, as IDRs and as Smart P virtual intra frames. The
+ * QP is fixed, so that both streams have the same quality.
+ *
+ * Usage: mppsmartp [interval [width height [n-frames]]]
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <gst/gst.h>
+#include <gst/app/gstappsink.h>
+
+#define DEFAULT_INTERVAL 30
+#define DEFAULT_WIDTH 1280
+#define DEFAULT_HEIGHT 720
+#define DEFAULT_N_FRAMES 600
+#define QP 26
+
+typedef struct
+{
+  guint frames;
+  guint intra_frames;
+  guint64 bytes;
+} Sizes;
+
+static gboolean
+encode (const gchar * settings, gint width, gint height, guint n_frames,
+    Sizes * sizes)
+{
+  GstElement *pipeline, *sink;
+  GstSample *sample;
+  GstBuffer *buffer;
+  gchar *desc;
+
+  /* Nothing moves, the P frames only carry what the IDRs can't reuse */
+  desc = g_strdup_printf ("videotestsrc num-buffers=%u pattern=smpte ! "
+      "video/x-raw,format=NV12,width=%d,height=%d,framerate=30/1 ! "
+      "mpph264enc rc-mode=cqp qp-init=%d %s ! "
+      "video/x-h264,stream-format=byte-stream,alignment=au ! "
+      "appsink name=sink sync=false", n_frames, width, height, QP, settings);
+  pipeline = gst_parse_launch (desc, NULL);
+  g_free (desc);
+  if (!pipeline)
+    return FALSE;
+
+  sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  memset (sizes, 0, sizeof (*sizes));
+  while ((sample = gst_app_sink_pull_sample (GST_APP_SINK (sink)))) {
+    buffer = gst_sample_get_buffer (sample);
+
+    sizes->frames++;
+    if (!GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT))
+      sizes->intra_frames++;
+    sizes->bytes += gst_buffer_get_size (buffer);
+    gst_sample_unref (sample);
+  }
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (sink);
+  gst_object_unref (pipeline);
+
+  return sizes->frames > 0;
+}
+
+static void
+print_sizes (const gchar * name, const Sizes * sizes)
+{
+  g_print ("%-13s  %6u  %5u  %10" G_GUINT64_FORMAT "  %8.0f  %8.1f\n", name,
+      sizes->frames, sizes->intra_frames, sizes->bytes,
+      (gdouble) sizes->bytes / sizes->frames,
+      sizes->bytes * 8 * 30 / 1000.0 / sizes->frames);
+}
+
+gint
+main (gint argc, gchar * argv[])
+{
+  gint width = DEFAULT_WIDTH, height = DEFAULT_HEIGHT;
+  guint interval = DEFAULT_INTERVAL, n_frames = DEFAULT_N_FRAMES;
+  Sizes gop, smart_p;
+  gchar *settings;
+  gboolean ok;
+
+  gst_init (&argc, &argv);
+
+  if (argc > 1)
+    interval = atoi (argv[1]);
+  if (argc > 3) {
+    width = atoi (argv[2]);
+    height = atoi (argv[3]);
+  }
+  if (argc > 4)
+    n_frames = atoi (argv[4]);
+
+  settings = g_strdup_printf ("gop=%u vi-interval=0", interval);
+  ok = encode (settings, width, height, n_frames, &gop);
+  g_free (settings);
+  if (!ok) {
+    g_printerr ("encoding with periodic IDRs failed\n");
+    return 1;
+  }
+
+  /* The IDRs are left to the default gop of Smart P */
+  settings = g_strdup_printf ("vi-interval=%u", interval);
+  ok = encode (settings, width, height, n_frames, &smart_p);
+  g_free (settings);
+  if (!ok) {
+    g_printerr ("encoding with Smart P failed\n");
+    return 1;
+  }
+
+  g_print ("%dx%d static, an access point every %u frames, qp %d\n", width,
+      height, interval, QP);
+  g_print ("mode           frames    idr       bytes     frame      kbps\n");
+  print_sizes ("periodic IDR", &gop);
+  print_sizes ("Smart P", &smart_p);
+  g_print ("Smart P is %.1f%% of the periodic IDR stream\n",
+      smart_p.bytes * 100.0 / gop.bytes);
+
+  return 0;
+}
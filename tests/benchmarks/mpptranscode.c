@@ -0,0 +1,205 @@
+/*
+ * Copyright 2018 Rockchip Electronics Co., Ltd
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Frames per second and CPU load of mppvideodec ! mpph264enc, with the
+ * decoded MPP buffers given to the encoder as they are, then copied into
+ * system memory in front of it as they were before the direct path. The
+ * stream is encoded once beforehand and pushed from memory.
+ *
+ * Usage: mpptranscode [width height [n-frames]]
+ */
+
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <gst/gst.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/app/gstappsink.h>
+
+#define DEFAULT_WIDTH 3840
+#define DEFAULT_HEIGHT 2160
+#define DEFAULT_N_FRAMES 300
+
+static GList *
+encode_stream (gint width, gint height, guint n_frames, GstCaps ** caps)
+{
+  GstElement *pipeline, *sink;
+  GstSample *sample;
+  GList *frames = NULL;
+  gchar *desc;
+
+  desc = g_strdup_printf ("videotestsrc num-buffers=%u pattern=ball ! "
+      "video/x-raw,format=NV12,width=%d,height=%d,framerate=30/1 ! "
+      "mpph264enc ! video/x-h264,stream-format=byte-stream,alignment=au ! "
+      "appsink name=sink sync=false", n_frames, width, height);
+  pipeline = gst_parse_launch (desc, NULL);
+  g_free (desc);
+  if (!pipeline)
+    return NULL;
+
+  sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  *caps = NULL;
+  while ((sample = gst_app_sink_pull_sample (GST_APP_SINK (sink)))) {
+    if (!*caps)
+      *caps = gst_caps_copy (gst_sample_get_caps (sample));
+    frames = g_list_prepend (frames,
+        gst_buffer_ref (gst_sample_get_buffer (sample)));
+    gst_sample_unref (sample);
+  }
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (sink);
+  gst_object_unref (pipeline);
+
+  return g_list_reverse (frames);
+}
+
+/* Hand the encoder a copy of the decoded frame in system memory */
+static GstPadProbeReturn
+copy_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  GstBuffer *copy;
+  GstMapInfo map;
+
+  if (!gst_buffer_map (buffer, &map, GST_MAP_READ))
+    return GST_PAD_PROBE_OK;
+
+  copy = gst_buffer_new_allocate (NULL, map.size, NULL);
+  gst_buffer_fill (copy, 0, map.data, map.size);
+  gst_buffer_unmap (buffer, &map);
+  gst_buffer_copy_into (copy, buffer, GST_BUFFER_COPY_METADATA, 0, -1);
+
+  gst_buffer_unref (buffer);
+  GST_PAD_PROBE_INFO_DATA (info) = copy;
+
+  return GST_PAD_PROBE_OK;
+}
+
+static gint64
+cpu_time (void)
+{
+  struct rusage usage;
+
+  getrusage (RUSAGE_SELF, &usage);
+
+  return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * G_USEC_PER_SEC
+      + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+/* Returns the frames per second, 0 on error, and the CPU load in percent
+ * of one core */
+static gdouble
+transcode (GList * frames, GstCaps * caps, gboolean copy, gdouble * cpu)
+{
+  GstElement *pipeline, *src, *enc;
+  GstPad *pad;
+  GstMessage *msg;
+  GList *l;
+  gint64 start, end, cpu_start;
+  guint n = 0;
+
+  pipeline = gst_parse_launch ("appsrc name=src format=time ! h264parse ! "
+      "mppvideodec ! mpph264enc name=enc ! fakesink sync=false", NULL);
+  if (!pipeline)
+    return 0;
+
+  src = gst_bin_get_by_name (GST_BIN (pipeline), "src");
+  gst_app_src_set_caps (GST_APP_SRC (src), caps);
+
+  if (copy) {
+    enc = gst_bin_get_by_name (GST_BIN (pipeline), "enc");
+    pad = gst_element_get_static_pad (enc, "sink");
+    gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, copy_probe, NULL,
+        NULL);
+    gst_object_unref (pad);
+    gst_object_unref (enc);
+  }
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  start = g_get_monotonic_time ();
+  cpu_start = cpu_time ();
+  for (l = frames; l; l = l->next, n++)
+    gst_app_src_push_buffer (GST_APP_SRC (src), gst_buffer_ref (l->data));
+  gst_app_src_end_of_stream (GST_APP_SRC (src));
+
+  msg = gst_bus_timed_pop_filtered (GST_ELEMENT_BUS (pipeline),
+      GST_CLOCK_TIME_NONE, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  end = g_get_monotonic_time ();
+  *cpu = (cpu_time () - cpu_start) * 100.0 / (end - start);
+
+  if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR)
+    n = 0;
+  gst_message_unref (msg);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (src);
+  gst_object_unref (pipeline);
+
+  return n * G_USEC_PER_SEC / (gdouble) (end - start);
+}
+
+gint
+main (gint argc, gchar * argv[])
+{
+  GList *frames;
+  GstCaps *caps;
+  gint width = DEFAULT_WIDTH, height = DEFAULT_HEIGHT;
+  guint n_frames = DEFAULT_N_FRAMES;
+  gdouble fps, cpu;
+
+  gst_init (&argc, &argv);
+
+  if (argc > 2) {
+    width = atoi (argv[1]);
+    height = atoi (argv[2]);
+  }
+  if (argc > 3)
+    n_frames = atoi (argv[3]);
+
+  frames = encode_stream (width, height, n_frames, &caps);
+  if (!frames || !caps) {
+    g_printerr ("failed to encode the test stream\n");
+    return 1;
+  }
+
+  g_print ("%u frames of %dx%d\n", g_list_length (frames), width, height);
+  g_print ("path      fps    cpu %%\n");
+
+  fps = transcode (frames, caps, FALSE, &cpu);
+  if (fps == 0) {
+    g_printerr ("transcoding failed\n");
+    return 1;
+  }
+  g_print ("direct  %6.1f  %6.1f\n", fps, cpu);
+
+  fps = transcode (frames, caps, TRUE, &cpu);
+  if (fps == 0) {
+    g_printerr ("transcoding through a copy failed\n");
+    return 1;
+  }
+  g_print ("copy    %6.1f  %6.1f\n", fps, cpu);
+
+  g_list_free_full (frames, (GDestroyNotify) gst_buffer_unref);
+  gst_caps_unref (caps);
+
+  return 0;
+}
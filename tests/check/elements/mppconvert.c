@@ -0,0 +1,245 @@
+/*
+ * Copyright 2018 Rockchip Electronics Co., Ltd
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <string.h>
+#include <gst/check/gstcheck.h>
+#include <gst/video/video.h>
+
+#include "gstmppconvert.h"
+
+/* From mppconvertscalar.c */
+GstMppConvertFunc gst_mpp_convert_get_scalar_func (GstVideoFormat format);
+
+#define SENTINEL 0xa5
+
+/* BT.601 limited range, as in the kernels */
+#define RGB_TO_Y(r, g, b) (((66 * (r) + 129 * (g) + 25 * (b) + 128) >> 8) + 16)
+#define RGB_TO_U(r, g, b) (((112 * (b) - 38 * (r) - 74 * (g) + 128) >> 8) + 128)
+#define RGB_TO_V(r, g, b) (((112 * (r) - 94 * (g) - 18 * (b) + 128) >> 8) + 128)
+
+static const GstVideoFormat formats[] = {
+  GST_VIDEO_FORMAT_YUY2, GST_VIDEO_FORMAT_I420, GST_VIDEO_FORMAT_BGRx,
+};
+
+/* Around the 16 and 32 pixels of the NEON loops, and odd */
+static const gint widths[] = { 1, 2, 3, 15, 16, 17, 31, 32, 33, 47, 64, 65,
+  97
+};
+static const gint heights[] = { 1, 2, 3, 4, 5, 16, 17 };
+
+/* Extra bytes at the end of each source line */
+static const gint src_pads[] = { 0, 7, 64 };
+
+/* Extra bytes after the 16 aligned destination lines */
+static const gint dst_pads[] = { 0, 16 };
+
+/* Map a frame of random content, each plane line padded by @pad bytes */
+static void
+make_frame (GstVideoFrame * frame, GstVideoFormat format, gint width,
+    gint height, gint pad, GRand * rand)
+{
+  GstVideoInfo info;
+  GstBuffer *buffer;
+  GstMapInfo map;
+  gsize offset = 0, i;
+  guint plane;
+
+  gst_video_info_set_format (&info, format, width, height);
+  for (plane = 0; plane < GST_VIDEO_INFO_N_PLANES (&info); plane++) {
+    info.stride[plane] += pad;
+    info.offset[plane] = offset;
+    offset += info.stride[plane] * GST_VIDEO_INFO_COMP_HEIGHT (&info, plane);
+  }
+  info.size = offset;
+
+  buffer = gst_buffer_new_allocate (NULL, info.size, NULL);
+  gst_buffer_map (buffer, &map, GST_MAP_WRITE);
+  for (i = 0; i < map.size; i++)
+    map.data[i] = g_rand_int_range (rand, 0, 256);
+  gst_buffer_unmap (buffer, &map);
+
+  fail_unless (gst_video_frame_map (frame, &info, buffer, GST_MAP_READ));
+  gst_buffer_unref (buffer);
+}
+
+static const guint8 *
+pixel (GstVideoFrame * frame, gint plane, gint x, gint y, gint bpp)
+{
+  return (guint8 *) GST_VIDEO_FRAME_PLANE_DATA (frame, plane) +
+      y * GST_VIDEO_FRAME_PLANE_STRIDE (frame, plane) + x * bpp;
+}
+
+static guint8
+ref_y (GstVideoFrame * src, gint x, gint y)
+{
+  const guint8 *p;
+
+  switch (GST_VIDEO_FRAME_FORMAT (src)) {
+    case GST_VIDEO_FORMAT_YUY2:
+      return *pixel (src, 0, x, y, 2);
+    case GST_VIDEO_FORMAT_I420:
+      return *pixel (src, 0, x, y, 1);
+    default:
+      p = pixel (src, 0, x, y, 4);
+      return RGB_TO_Y (p[2], p[1], p[0]);
+  }
+}
+
+/* @c is 0 for U and 1 for V, the chroma of an odd height's last line is
+ * taken from that line alone */
+static guint8
+ref_uv (GstVideoFrame * src, gint cx, gint cy, gint c)
+{
+  gint width = GST_VIDEO_FRAME_WIDTH (src);
+  gint y0 = cy * 2, y1 = MIN (cy * 2 + 1, GST_VIDEO_FRAME_HEIGHT (src) - 1);
+  const guint8 *p0, *p1;
+  gint r, g, b;
+
+  switch (GST_VIDEO_FRAME_FORMAT (src)) {
+    case GST_VIDEO_FORMAT_YUY2:
+      p0 = pixel (src, 0, cx * 2, y0, 2);
+      p1 = pixel (src, 0, cx * 2, y1, 2);
+      return (p0[1 + c * 2] + p1[1 + c * 2] + 1) >> 1;
+    case GST_VIDEO_FORMAT_I420:
+      return *pixel (src, 1 + c, cx, cy, 1);
+    default:
+      p0 = pixel (src, 0, cx * 2, y0, 4);
+      p1 = pixel (src, 0, cx * 2, y1, 4);
+      if (cx * 2 + 1 < width) {
+        b = (p0[0] + p0[4] + p1[0] + p1[4] + 2) >> 2;
+        g = (p0[1] + p0[5] + p1[1] + p1[5] + 2) >> 2;
+        r = (p0[2] + p0[6] + p1[2] + p1[6] + 2) >> 2;
+      } else {
+        b = (p0[0] + p1[0] + 1) >> 1;
+        g = (p0[1] + p1[1] + 1) >> 1;
+        r = (p0[2] + p1[2] + 1) >> 1;
+      }
+      if (c == 0)
+        return CLAMP (RGB_TO_U (r, g, b), 0, 255);
+      return CLAMP (RGB_TO_V (r, g, b), 0, 255);
+  }
+}
+
+/* Offset of the first byte of @dst differing from the expected NV12 frame,
+ * the padding must be left untouched, -1 when there is none */
+static gint
+check_nv12 (GstVideoFrame * src, const guint8 * dst, gint stride,
+    gint ver_stride)
+{
+  gint width = GST_VIDEO_FRAME_WIDTH (src);
+  gint height = GST_VIDEO_FRAME_HEIGHT (src);
+  const guint8 *uv = dst + stride * ver_stride;
+  gint x, y, expected;
+
+  for (y = 0; y < ver_stride; y++) {
+    for (x = 0; x < stride; x++) {
+      if (x < width && y < height)
+        expected = ref_y (src, x, y);
+      else
+        expected = SENTINEL;
+      if (dst[y * stride + x] != expected)
+        return y * stride + x;
+    }
+  }
+
+  for (y = 0; y < ver_stride / 2; y++) {
+    for (x = 0; x < stride; x++) {
+      if (x < GST_ROUND_UP_2 (width) && y < (height + 1) / 2)
+        expected = ref_uv (src, x / 2, y, x % 2);
+      else
+        expected = SENTINEL;
+      if (uv[y * stride + x] != expected)
+        return uv - dst + y * stride + x;
+    }
+  }
+
+  return -1;
+}
+
+GST_START_TEST (test_convert_kernels)
+{
+  GstVideoFormat format = formats[__i__];
+  GstMppConvertFunc convert, convert_scalar;
+  GstVideoFrame src;
+  GRand *rand;
+  guint8 *dst, *dst_scalar;
+  gint stride, ver_stride, size, offset;
+  guint w, h, sp, dp;
+
+  convert = gst_mpp_convert_get_func (format);
+  convert_scalar = gst_mpp_convert_get_scalar_func (format);
+  fail_unless (convert != NULL);
+  fail_unless (convert_scalar != NULL);
+
+  rand = g_rand_new_with_seed (format);
+
+  for (w = 0; w < G_N_ELEMENTS (widths); w++) {
+    for (h = 0; h < G_N_ELEMENTS (heights); h++) {
+      for (sp = 0; sp < G_N_ELEMENTS (src_pads); sp++) {
+        for (dp = 0; dp < G_N_ELEMENTS (dst_pads); dp++) {
+          make_frame (&src, format, widths[w], heights[h], src_pads[sp],
+              rand);
+
+          stride = GST_ROUND_UP_16 (widths[w]) + dst_pads[dp];
+          ver_stride = GST_ROUND_UP_16 (heights[h]);
+          size = stride * ver_stride * 3 / 2;
+          dst = g_malloc (size);
+          dst_scalar = g_malloc (size);
+          memset (dst, SENTINEL, size);
+          memset (dst_scalar, SENTINEL, size);
+
+          convert (&src, dst, stride, ver_stride);
+          convert_scalar (&src, dst_scalar, stride, ver_stride);
+
+          offset = check_nv12 (&src, dst_scalar, stride, ver_stride);
+          fail_unless (offset < 0, "%s %dx%d, pads %d/%d: scalar output "
+              "wrong at byte %d", gst_video_format_to_string (format),
+              widths[w], heights[h], src_pads[sp], dst_pads[dp], offset);
+          fail_unless (memcmp (dst, dst_scalar, size) == 0,
+              "%s %dx%d, pads %d/%d: the kernel differs from the scalar "
+              "code", gst_video_format_to_string (format), widths[w],
+              heights[h], src_pads[sp], dst_pads[dp]);
+
+          g_free (dst);
+          g_free (dst_scalar);
+          gst_video_frame_unmap (&src);
+        }
+      }
+    }
+  }
+
+  g_rand_free (rand);
+}
+
+GST_END_TEST;
+
+static Suite *
+mppconvert_suite (void)
+{
+  Suite *s = suite_create ("mppconvert");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_loop_test (tc_chain, test_convert_kernels, 0,
+      G_N_ELEMENTS (formats));
+
+  return s;
+}
+
+GST_CHECK_MAIN (mppconvert);
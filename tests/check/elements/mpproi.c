@@ -0,0 +1,210 @@
+/*
+ * Copyright 2018 Rockchip Electronics Co., Ltd
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <gst/check/gstcheck.h>
+
+#include "gstmpproi.h"
+
+#define MAX_REGIONS 8
+#define ROI_QP -6
+#define BG_QP 4
+
+static GstVideoInfo info;
+
+static void
+setup (void)
+{
+  gst_video_info_set_format (&info, GST_VIDEO_FORMAT_NV12, 1920, 1080);
+}
+
+static void
+add_roi (GstBuffer * buffer, guint x, guint y, guint w, guint h)
+{
+  gst_buffer_add_video_region_of_interest_meta (buffer, "face", x, y, w, h);
+}
+
+static void
+check_region (const GstMppRoiRegion * region, guint x, guint y, guint w,
+    guint h, gint qp_delta)
+{
+  fail_unless_equals_int (region->x, x);
+  fail_unless_equals_int (region->y, y);
+  fail_unless_equals_int (region->w, w);
+  fail_unless_equals_int (region->h, h);
+  fail_unless_equals_int (region->qp_delta, qp_delta);
+}
+
+GST_START_TEST (test_roi_none)
+{
+  GstMppRoiRegion regions[MAX_REGIONS];
+  GstBuffer *buffer = gst_buffer_new ();
+
+  /* No region of interest, even with a background QP */
+  fail_unless_equals_int (gst_mpp_roi_from_buffer (buffer, &info, ROI_QP,
+          BG_QP, regions, MAX_REGIONS), 0);
+
+  /* Nothing to change */
+  add_roi (buffer, 0, 0, 64, 64);
+  fail_unless_equals_int (gst_mpp_roi_from_buffer (buffer, &info, 0, 0,
+          regions, MAX_REGIONS), 0);
+
+  gst_buffer_unref (buffer);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_roi_clip)
+{
+  GstMppRoiRegion regions[MAX_REGIONS];
+  GstBuffer *buffer = gst_buffer_new ();
+  guint n;
+
+  /* Grown to whole macroblocks */
+  add_roi (buffer, 5, 7, 10, 10);
+  /* Crossing the bottom right corner, the last row of macroblocks is only
+   * partly in the 1080 lines */
+  add_roi (buffer, 1900, 1060, 100, 100);
+  /* Outside of the frame */
+  add_roi (buffer, 2000, 100, 64, 64);
+  add_roi (buffer, 100, 1080, 64, 64);
+  /* Empty */
+  add_roi (buffer, 320, 320, 0, 16);
+
+  n = gst_mpp_roi_from_buffer (buffer, &info, ROI_QP, 0, regions,
+      MAX_REGIONS);
+  fail_unless_equals_int (n, 2);
+  check_region (&regions[0], 0, 0, 16, 32, ROI_QP);
+  check_region (&regions[1], 1888, 1056, 32, 32, ROI_QP);
+
+  gst_buffer_unref (buffer);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_roi_background)
+{
+  GstMppRoiRegion regions[MAX_REGIONS];
+  GstBuffer *buffer = gst_buffer_new ();
+  guint n;
+
+  add_roi (buffer, 64, 64, 128, 128);
+
+  /* The background comes first, the regions of interest override it */
+  n = gst_mpp_roi_from_buffer (buffer, &info, ROI_QP, BG_QP, regions,
+      MAX_REGIONS);
+  fail_unless_equals_int (n, 2);
+  check_region (&regions[0], 0, 0, 1920, 1088, BG_QP);
+  check_region (&regions[1], 64, 64, 128, 128, ROI_QP);
+
+  /* Only the background delta, the regions keep the frame QP */
+  n = gst_mpp_roi_from_buffer (buffer, &info, 0, BG_QP, regions,
+      MAX_REGIONS);
+  fail_unless_equals_int (n, 2);
+  check_region (&regions[0], 0, 0, 1920, 1088, BG_QP);
+  check_region (&regions[1], 64, 64, 128, 128, 0);
+
+  gst_buffer_unref (buffer);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_roi_merge)
+{
+  GstMppRoiRegion regions[MAX_REGIONS];
+  GstBuffer *buffer = gst_buffer_new ();
+  guint n;
+
+  add_roi (buffer, 64, 64, 128, 128);
+  /* The same macroblocks once aligned */
+  add_roi (buffer, 70, 70, 120, 120);
+  /* Within the first one */
+  add_roi (buffer, 96, 96, 32, 32);
+  /* Overlapping only, kept */
+  add_roi (buffer, 160, 160, 64, 64);
+  /* Containing the first one, kept as it covers more */
+  add_roi (buffer, 0, 0, 256, 256);
+
+  n = gst_mpp_roi_from_buffer (buffer, &info, ROI_QP, BG_QP, regions,
+      MAX_REGIONS);
+  fail_unless_equals_int (n, 4);
+  check_region (&regions[0], 0, 0, 1920, 1088, BG_QP);
+  check_region (&regions[1], 64, 64, 128, 128, ROI_QP);
+  check_region (&regions[2], 160, 160, 64, 64, ROI_QP);
+  check_region (&regions[3], 0, 0, 256, 256, ROI_QP);
+
+  gst_buffer_unref (buffer);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_roi_limit)
+{
+  GstMppRoiRegion regions[MAX_REGIONS + 1];
+  GstBuffer *buffer = gst_buffer_new ();
+  guint i, n;
+
+  for (i = 0; i < MAX_REGIONS + 2; i++)
+    add_roi (buffer, i * 128, 0, 64, 64);
+
+  /* The regions after the limit are dropped, the array isn't overrun */
+  regions[MAX_REGIONS].qp_delta = 42;
+  n = gst_mpp_roi_from_buffer (buffer, &info, ROI_QP, 0, regions,
+      MAX_REGIONS);
+  fail_unless_equals_int (n, MAX_REGIONS);
+  for (i = 0; i < MAX_REGIONS; i++)
+    check_region (&regions[i], i * 128, 0, 64, 64, ROI_QP);
+  fail_unless_equals_int (regions[MAX_REGIONS].qp_delta, 42);
+
+  /* The background takes one of them */
+  n = gst_mpp_roi_from_buffer (buffer, &info, ROI_QP, BG_QP, regions,
+      MAX_REGIONS);
+  fail_unless_equals_int (n, MAX_REGIONS);
+  check_region (&regions[0], 0, 0, 1920, 1088, BG_QP);
+  for (i = 1; i < MAX_REGIONS; i++)
+    check_region (&regions[i], (i - 1) * 128, 0, 64, 64, ROI_QP);
+  fail_unless_equals_int (regions[MAX_REGIONS].qp_delta, 42);
+
+  /* With a single region, the region of interest wins over the background */
+  n = gst_mpp_roi_from_buffer (buffer, &info, ROI_QP, BG_QP, regions, 1);
+  fail_unless_equals_int (n, 1);
+  check_region (&regions[0], 0, 0, 64, 64, ROI_QP);
+
+  gst_buffer_unref (buffer);
+}
+
+GST_END_TEST;
+
+static Suite *
+mpproi_suite (void)
+{
+  Suite *s = suite_create ("mpproi");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_checked_fixture (tc_chain, setup, NULL);
+  tcase_add_test (tc_chain, test_roi_none);
+  tcase_add_test (tc_chain, test_roi_clip);
+  tcase_add_test (tc_chain, test_roi_background);
+  tcase_add_test (tc_chain, test_roi_merge);
+  tcase_add_test (tc_chain, test_roi_limit);
+
+  return s;
+}
+
+GST_CHECK_MAIN (mpproi);
@@ -0,0 +1,264 @@
+/*
+ * Copyright 2018 Rockchip Electronics Co., Ltd
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <string.h>
+#include <gst/check/gstcheck.h>
+#include <gst/check/gstharness.h>
+#include <gst/app/gstappsink.h>
+#include <gst/video/video.h>
+
+#define N_INSTANCES 8
+#define N_CYCLES 50
+#define N_FRAMES 30
+
+static const gchar *encoders[] = { "mpph264enc", "mpph265enc", "mppjpegenc" };
+
+static gboolean
+have_element (const gchar * name)
+{
+  GstElementFactory *factory;
+
+  factory = gst_element_factory_find (name);
+  if (!factory)
+    return FALSE;
+
+  gst_object_unref (factory);
+  return TRUE;
+}
+
+/* Each thread opens and closes its own encoder */
+static gpointer
+open_close_thread (gpointer data)
+{
+  const gchar *name = data;
+  GstElement *enc;
+  guint i;
+
+  enc = gst_element_factory_make (name, NULL);
+  fail_unless (enc != NULL);
+
+  for (i = 0; i < N_CYCLES; i++) {
+    fail_unless_equals_int (gst_element_set_state (enc, GST_STATE_READY),
+        GST_STATE_CHANGE_SUCCESS);
+    fail_unless_equals_int (gst_element_set_state (enc, GST_STATE_NULL),
+        GST_STATE_CHANGE_SUCCESS);
+  }
+
+  gst_object_unref (enc);
+
+  return NULL;
+}
+
+GST_START_TEST (test_concurrent_open_close)
+{
+  GThread *threads[N_INSTANCES];
+  const gchar *name = encoders[__i__];
+  guint i;
+
+  if (!have_element (name)) {
+    GST_INFO ("%s not available, skipping", name);
+    return;
+  }
+
+  for (i = 0; i < N_INSTANCES; i++)
+    threads[i] = g_thread_new (NULL, open_close_thread, (gpointer) name);
+  for (i = 0; i < N_INSTANCES; i++)
+    g_thread_join (threads[i]);
+}
+
+GST_END_TEST;
+
+typedef struct
+{
+  const gchar *name;
+  GByteArray *output;
+  guint frames;
+} EncodeJob;
+
+static GstFlowReturn
+encode_new_sample (GstAppSink * sink, gpointer user_data)
+{
+  EncodeJob *job = user_data;
+  GstSample *sample;
+  GstMapInfo map;
+
+  sample = gst_app_sink_pull_sample (sink);
+  fail_unless (gst_buffer_map (gst_sample_get_buffer (sample), &map,
+          GST_MAP_READ));
+  g_byte_array_append (job->output, map.data, map.size);
+  gst_buffer_unmap (gst_sample_get_buffer (sample), &map);
+  gst_sample_unref (sample);
+  job->frames++;
+
+  return GST_FLOW_OK;
+}
+
+/* Each thread runs a whole encoding pipeline to the end and keeps the
+ * stream. The input is the same for all of them and the QP is fixed, so
+ * that every stream must be the same. */
+static gpointer
+encode_thread (gpointer data)
+{
+  EncodeJob *job = data;
+  GstAppSinkCallbacks callbacks = { NULL, };
+  GstElement *pipeline, *enc, *sink;
+  GstMessage *msg;
+  gchar *desc;
+
+  desc = g_strdup_printf ("videotestsrc num-buffers=%d pattern=ball ! "
+      "video/x-raw,format=NV12,width=320,height=240,framerate=30/1 ! "
+      "%s name=enc ! appsink name=sink sync=false", N_FRAMES, job->name);
+  pipeline = gst_parse_launch (desc, NULL);
+  g_free (desc);
+  fail_unless (pipeline != NULL);
+
+  enc = gst_bin_get_by_name (GST_BIN (pipeline), "enc");
+  if (g_object_class_find_property (G_OBJECT_GET_CLASS (enc), "rc-mode"))
+    gst_util_set_object_arg (G_OBJECT (enc), "rc-mode", "cqp");
+  gst_object_unref (enc);
+
+  job->output = g_byte_array_new ();
+  job->frames = 0;
+  callbacks.new_sample = encode_new_sample;
+  sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+  gst_app_sink_set_callbacks (GST_APP_SINK (sink), &callbacks, job, NULL);
+  gst_object_unref (sink);
+
+  fail_if (gst_element_set_state (pipeline, GST_STATE_PLAYING) ==
+      GST_STATE_CHANGE_FAILURE);
+
+  msg = gst_bus_timed_pop_filtered (GST_ELEMENT_BUS (pipeline),
+      GST_CLOCK_TIME_NONE, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  fail_unless_equals_string (GST_MESSAGE_TYPE_NAME (msg), "eos");
+  gst_message_unref (msg);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+
+  return NULL;
+}
+
+GST_START_TEST (test_concurrent_encode)
+{
+  GThread *threads[N_INSTANCES];
+  EncodeJob ref, jobs[N_INSTANCES];
+  const gchar *name = encoders[__i__];
+  guint i;
+
+  if (!have_element (name)) {
+    GST_INFO ("%s not available, skipping", name);
+    return;
+  }
+
+  /* The stream of an instance running alone */
+  ref.name = name;
+  encode_thread (&ref);
+  fail_unless (ref.output->len > 0);
+
+  for (i = 0; i < N_INSTANCES; i++) {
+    jobs[i].name = name;
+    threads[i] = g_thread_new (NULL, encode_thread, &jobs[i]);
+  }
+  for (i = 0; i < N_INSTANCES; i++)
+    g_thread_join (threads[i]);
+
+  for (i = 0; i < N_INSTANCES; i++) {
+    fail_unless_equals_int (jobs[i].frames, ref.frames);
+    fail_unless_equals_int (jobs[i].output->len, ref.output->len);
+    fail_unless (memcmp (jobs[i].output->data, ref.output->data,
+            ref.output->len) == 0, "instance %u encoded a different stream",
+        i);
+    g_byte_array_unref (jobs[i].output);
+  }
+  g_byte_array_unref (ref.output);
+}
+
+GST_END_TEST;
+
+#define FORCED_FRAME 10
+
+/* A force-key-unit event in the middle of a GOP gives an IDR frame */
+GST_START_TEST (test_force_key_unit)
+{
+  const gchar *name = encoders[__i__];
+  GstHarness *h;
+  GstBuffer *buf;
+  GstClockTime forced_pts;
+  gboolean found = FALSE;
+  guint i;
+
+  if (!have_element (name)) {
+    GST_INFO ("%s not available, skipping", name);
+    return;
+  }
+
+  h = gst_harness_new (name);
+  g_object_set (h->element, "gop", 300, NULL);
+  gst_harness_set_src_caps_str (h, "video/x-raw,format=NV12,width=320,"
+      "height=240,framerate=30/1");
+
+  forced_pts = gst_util_uint64_scale (FORCED_FRAME, GST_SECOND, 30);
+  for (i = 0; i < 2 * FORCED_FRAME; i++) {
+    if (i == FORCED_FRAME)
+      fail_unless (gst_harness_push_event (h,
+              gst_video_event_new_downstream_force_key_unit (forced_pts,
+                  GST_CLOCK_TIME_NONE, GST_CLOCK_TIME_NONE, TRUE, 1)));
+
+    buf = gst_harness_create_buffer (h, 320 * 240 * 3 / 2);
+    gst_buffer_memset (buf, 0, 0x80 + i, 320 * 240 * 3 / 2);
+    GST_BUFFER_PTS (buf) = gst_util_uint64_scale (i, GST_SECOND, 30);
+    GST_BUFFER_DURATION (buf) = gst_util_uint64_scale (1, GST_SECOND, 30);
+    fail_unless_equals_int (gst_harness_push (h, buf), GST_FLOW_OK);
+  }
+  fail_unless (gst_harness_push_event (h, gst_event_new_eos ()));
+
+  /* The frame may be split in several NAL units, they all have its pts */
+  while ((buf = gst_harness_try_pull (h))) {
+    if (GST_BUFFER_PTS (buf) == forced_pts) {
+      fail_if (GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT));
+      found = TRUE;
+    }
+    gst_buffer_unref (buf);
+  }
+  fail_unless (found);
+
+  gst_harness_teardown (h);
+}
+
+GST_END_TEST;
+
+static Suite *
+mppvideoenc_suite (void)
+{
+  Suite *s = suite_create ("mppvideoenc");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_set_timeout (tc_chain, 120);
+  tcase_add_loop_test (tc_chain, test_concurrent_open_close, 0,
+      G_N_ELEMENTS (encoders));
+  tcase_add_loop_test (tc_chain, test_concurrent_encode, 0,
+      G_N_ELEMENTS (encoders));
+  /* mppjpegenc only has keyframes */
+  tcase_add_loop_test (tc_chain, test_force_key_unit, 0, 2);
+
+  return s;
+}
+
+GST_CHECK_MAIN (mppvideoenc);